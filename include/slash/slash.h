@@ -25,7 +25,10 @@
 #define _SLASH_H_
 
 #include <stdio.h>
+#include <stdarg.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 #ifdef SLASH_HAVE_TERMIOS_H
 #include <termios.h>
@@ -33,30 +36,87 @@
 
 /* Configuration */
 #define SLASH_SHOW_MAX		25	/* Maximum number of commands to list */
-#define SLASH_ARG_MAX		16	/* Maximum number of arguments, including command name */
+#define SLASH_ARGS_SIZE		512	/* Initial bytes of argument memory in slash_create() */
+#define SLASH_ARG_MAX		16	/* Maximum number of arguments of prepared commands */
+#define SLASH_SCRATCH_SIZE	256	/* Bytes of argument memory of prepared commands */
+#define SLASH_VARS_SIZE		256	/* Bytes of variable memory in slash_create() */
+#define SLASH_VAR_BUCKETS	8	/* Number of variable hash buckets */
+#define SLASH_INPUT_SIZE	32	/* Bytes of buffered input */
+#define SLASH_PASTE_SIZE	256	/* Bytes of queued paste in slash_create() */
+#define SLASH_PRINTF_SIZE	128	/* Bytes of slash_printf() output buffered on the stack */
+#define SLASH_FRAME_SIZE	128	/* Bytes of line refresh output written at once */
+
+/* Access levels */
+#define SLASH_LEVEL_OPERATOR	0
+#define SLASH_LEVEL_ENGINEER	1
+#define SLASH_LEVEL_DEVELOPER	2
+#define SLASH_LEVEL_FACTORY	3
+#define SLASH_LEVEL_COUNT	4
 
 /* Command flags */
 #define SLASH_FLAG_HIDDEN	(1 << 0) /* Hidden and not shown in help or completion */
 #define SLASH_FLAG_PRIVILEGED	(1 << 1) /* Privileged and hidden until enabled with slash_set_privileged() */
+#define SLASH_FLAG_LEVEL_SHIFT	1
+#define SLASH_FLAG_LEVEL_MASK	(0x3 << SLASH_FLAG_LEVEL_SHIFT)
+#define SLASH_FLAG_LEVEL(_level) (((_level) << SLASH_FLAG_LEVEL_SHIFT) & SLASH_FLAG_LEVEL_MASK) /* Hidden below access level */
+#define SLASH_FLAG_ALIAS	(1 << 3) /* Alias for the command in the context pointer */
+#define SLASH_FLAG_COMPRESSED	(1 << 4) /* Help text compressed by tools/slashgen.py */
+#define SLASH_FLAG_SPANS	(1 << 5) /* Arguments only passed as spans, argv is not built */
 
 /* Macro used to map based on presence of optional arguments */
 #define __slash_map_macro(_0, _1, _2, _name, ...) _name
 
-#define __slash_command(_ident, _group, _name, _func, _args, _help, _flags, _context) \
-	__attribute__((section(".slash." # _ident), used, aligned(sizeof(long)))) \
+#define __slash_stringify(_x) #_x
+#define __slash_xstringify(_x) __slash_stringify(_x)
+
+#ifdef SLASH_COMPRESS_HELP
+/* The help text is kept in a section discarded by the linker script, where
+ * tools/slashgen.py reads it and generates the compressed text. The help
+ * argument must therefore be a string literal or NULL. */
+#define __slash_help(_ident, _path, _help) \
+	__attribute__((section(".slash_help." _path), used)) \
+	static const char slash_help_text_ ## _ident[] = __slash_xstringify(_help); \
+	extern const char slash_help_ ## _ident[] __attribute__((weak));
+#define __slash_help_text(_ident, _help) slash_help_ ## _ident
+#define __slash_help_flags SLASH_FLAG_COMPRESSED
+#else
+#define __slash_help(_ident, _path, _help)
+#define __slash_help_text(_ident, _help) _help
+#define __slash_help_flags 0
+#endif
+
+/* The args argument is either a usage string or a struct slash_schema pointer */
+#define __slash_args_text(_args) \
+	_Generic((_args), \
+		 const struct slash_schema *: NULL, \
+		 struct slash_schema *: NULL, \
+		 default: (_args))
+#define __slash_args_schema(_args) \
+	_Generic((_args), \
+		 const struct slash_schema *: (_args), \
+		 struct slash_schema *: (_args), \
+		 default: NULL)
+
+/* The section name holds the command path, so the linker sorts by path */
+#define __slash_command(_ident, _path, _group, _name, _func, _args, _help, _flags, _context) \
+	__slash_help(_ident, _path, _help) \
+	__attribute__((section(".slash." _path), used, aligned(sizeof(long)))) \
 	struct slash_command _ident = { \
 		.name  = #_name, \
+		.namelen = sizeof(#_name) - 1, \
 		.parent = _group, \
 		.func  = _func, \
-		.args  = _args, \
-		.help  = _help, \
-		.flags = _flags, \
+		.args  = __slash_args_text(_args), \
+		.schema = __slash_args_schema(_args), \
+		.help  = __slash_help_text(_ident, _help), \
+		.flags = (_flags) | __slash_help_flags, \
 		.context = _context, \
 	}
 
 /* Top-level commands */
 #define __slash_command_all(_name, _func, _args, _help, _flags, _context) \
 	__slash_command(slash_cmd_ ## _name, \
+			#_name, \
 			NULL, \
 			_name, _func, _args, _help, _flags, _context)
 
@@ -70,6 +130,8 @@
  * slash_command() - Declare top-level command
  * @_name: Name of the command, without quotes.
  * @_func: Function to execute for this command.
+ * @_args: Argument description string, pointer to argument schema declared
+ * with slash_schema(), or NULL.
  * @_help: Description string of the group.
  * @_flags: Optional, bitwise OR of SLASH_FLAG_XXX flags.
  * @_context: Optional, context passed to command through slash->context.
@@ -84,6 +146,7 @@
 /* Subcommand */
 #define __slash_command_sub_all(_group, _name, _func, _args, _help, _flags, _context) \
 	__slash_command(slash_cmd_ ## _group ## _ ## _name, \
+			#_group "." #_name, \
 			&slash_cmd_ ## _group, \
 			_name, _func, _args, _help, _flags, _context)
 
@@ -112,6 +175,7 @@
 /* Subsubcommand */
 #define __slash_command_subsub_all(_group, _subgroup, _name, _func, _args, _help, _flags, _context) \
 	__slash_command(slash_cmd_ ## _group ## _ ## _subgroup ## _ ## _name,\
+			#_group "." #_subgroup "." #_name, \
 			&slash_cmd_ ## _group ## _ ## _subgroup, \
 			_name, _func, _args, _help, _flags, _context)
 
@@ -125,6 +189,7 @@
 #define __slash_command_subsubsub_all(_group, _subgroup, _subsubgroup, _name, \
 				      _func, _args, _help, _flags, _context) \
 	__slash_command(slash_cmd_ ## _group ## _ ## _subgroup ## _ ## _subsubgroup ## _ ## _name,\
+			#_group "." #_subgroup "." #_subsubgroup "." #_name, \
 			&slash_cmd_ ## _group ## _ ## _subgroup ## _ ## _subsubgroup, \
 			_name, _func, _args, _help, _flags, _context)
 
@@ -206,6 +271,33 @@
 #define slash_command_subsubgroup(_group, _subgroup, _name, _help, ...) \
 	slash_command_subsub(_group, _subgroup, _name, NULL, NULL, _help, ##__VA_ARGS__)
 
+/**
+ * slash_command_alias() - Declare top-level alias
+ * @_name: Name of the alias, without quotes.
+ * @_command: Identifier of the aliased command, e.g. slash_cmd_group_name.
+ *
+ * The alias is resolved when commands are looked up, so it executes, lists
+ * and completes the subcommands of the aliased command. The aliased command
+ * must not be an alias itself.
+ */
+#define slash_command_alias(_name, _command) \
+	__slash_command(slash_cmd_ ## _name, \
+			#_name, \
+			NULL, \
+			_name, NULL, NULL, NULL, SLASH_FLAG_ALIAS, &_command)
+
+/**
+ * slash_command_sub_alias() - Declare alias in group
+ * @_group: Name of the parent group, without quotes.
+ * @_name: Name of the alias, without quotes.
+ * @_command: Identifier of the aliased command, e.g. slash_cmd_group_name.
+ */
+#define slash_command_sub_alias(_group, _name, _command) \
+	__slash_command(slash_cmd_ ## _group ## _ ## _name, \
+			#_group "." #_name, \
+			&slash_cmd_ ## _group, \
+			_name, NULL, NULL, NULL, SLASH_FLAG_ALIAS, &_command)
+
 /* Deprecated but defined for backwards compatibility */
 #define slash_command_ex slash_command
 #define slash_command_sub_ex slash_command_sub
@@ -220,6 +312,81 @@ typedef int (*slash_func_t)(struct slash *slash);
 /* Wait function prototype */
 typedef int (*slash_waitfunc_t)(struct slash *slash, unsigned int ms);
 
+/**
+ * struct slash_io - I/O backend.
+ * @read: Read at least one and at most count bytes into buf, blocking until
+ * input is available. Returns the number of bytes read or a negative error.
+ * @write: Write count bytes from buf. Returns count or a negative error.
+ * @flush: Flush buffered output, or NULL if output is not buffered.
+ * @wait: Wait at most ms milliseconds for input and return the next input
+ * character, or -ETIMEDOUT. NULL if not supported.
+ * @rawmode: Enable or disable raw terminal mode, or NULL if not needed.
+ *
+ * The backend functions can find their state in slash->io_arg.
+ */
+struct slash_io {
+	int (*read)(struct slash *slash, void *buf, size_t count);
+	int (*write)(struct slash *slash, const void *buf, size_t count);
+	int (*flush)(struct slash *slash);
+	int (*wait)(struct slash *slash, unsigned int ms);
+	int (*rawmode)(struct slash *slash, bool enable);
+};
+
+/* Bundled backends using slash->file_read/file_write and slash->fd_read/fd_write */
+extern const struct slash_io slash_io_stdio;
+extern const struct slash_io slash_io_fd;
+
+/* Transmit ring policies when the ring is full */
+#define SLASH_RING_BLOCK	0	/* Wait for the driver to make room */
+#define SLASH_RING_DROP		1	/* Discard the output that does not fit */
+#define SLASH_RING_YIELD	2	/* Call the yield function until there is room */
+
+/**
+ * struct slash_ring - Transmit ring for interrupt or DMA driven output.
+ * @buffer: Ring buffer memory.
+ * @size: Size of the ring buffer, a power of 2.
+ * @head: Total number of bytes written to the ring by slash.
+ * @tail: Total number of bytes consumed from the ring by the driver.
+ * @dropped: Number of bytes discarded with SLASH_RING_DROP.
+ * @policy: SLASH_RING_XXX policy when the ring is full.
+ * @input: Backend used for input, wait and raw mode, or NULL.
+ * @start: Called after bytes have been written to the ring, or NULL.
+ * @yield: Called while the ring is full with SLASH_RING_YIELD, or NULL.
+ * @arg: Driver state.
+ *
+ * Output to the slash_io_ring backend is copied to the ring, and the start
+ * function is called so the driver can begin transmitting, if it is idle. The
+ * driver gets the next contiguous block of output using slash_ring_peek(),
+ * typically to start a DMA transfer or from the TX interrupt, and releases it
+ * with slash_ring_consume() once it has been sent. slash only writes @head
+ * and the driver only writes @tail, so the driver may run in interrupt
+ * context without locking.
+ *
+ * The functions of @input are called with the slash context, so they must not
+ * use slash->io_arg, which points to the ring.
+ *
+ * This struct should be initialized using slash_ring_init().
+ */
+struct slash_ring {
+	char *buffer;
+	size_t size;
+	size_t head;
+	size_t tail;
+	size_t dropped;
+	int policy;
+	const struct slash_io *input;
+	void (*start)(struct slash_ring *ring);
+	void (*yield)(struct slash_ring *ring);
+	void *arg;
+};
+
+/* Backend writing output to the struct slash_ring in slash->io_arg */
+extern const struct slash_io slash_io_ring;
+
+/* View filter prototype */
+struct slash_command;
+typedef bool (*slash_filter_t)(const struct slash_command *command, void *arg);
+
 /* Command return values */
 #define SLASH_EXIT	( 1)
 #define SLASH_SUCCESS	( 0)
@@ -236,9 +403,11 @@ typedef int (*slash_waitfunc_t)(struct slash *slash, unsigned int ms);
  * @name: Name of the command.
  * @func: Pointer to the handler function for this command.
  * @args: Pointer to the argument description string or NULL if the function
- * does not take arguments.
+ * does not take arguments or has a schema.
+ * @schema: Pointer to the argument schema or NULL.
  * @help: Pointer to the help string for the command.
  * @flags: Bitwise OR of one or more SLASH_FLAG_XXX values.
+ * @namelen: Length of the command name, or 0 if not known at compile time.
  * @context: Optional context pointer to pass to function instance.
  * @parent: Pointer to parent command or NULL if the function is a root
  * function.
@@ -247,23 +416,313 @@ typedef int (*slash_waitfunc_t)(struct slash *slash, unsigned int ms);
  */
 struct slash_command {
 	const char *name;
-	const slash_func_t func;
+	slash_func_t func;
 	const char *args;
+	const struct slash_schema *schema;
 	const char *help;
 	unsigned int flags;
+	unsigned short namelen;
 	void *context;
 	struct slash_command *parent;
 };
 
+/**
+ * struct slash_span - Argument in command line.
+ * @str: Pointer to first character of argument in the command line.
+ * @len: Length of argument in bytes.
+ *
+ * The argument is not NUL-terminated, and the surrounding quotes of quoted
+ * arguments are not included.
+ */
+struct slash_span {
+	const char *str;
+	size_t len;
+};
+
+/* Argument types */
+enum slash_arg_type {
+	SLASH_ARG_INT,		/* long, decimal, octal or hex with 0x prefix */
+	SLASH_ARG_HEX,		/* unsigned long, hex with optional 0x prefix */
+	SLASH_ARG_FLOAT,	/* double */
+	SLASH_ARG_ENUM,		/* int, index in list of values */
+	SLASH_ARG_STRING,	/* char *, pointer to argument */
+};
+
+/**
+ * struct slash_arg - Argument in a schema.
+ * @name: Name of the argument shown in usage and error messages.
+ * @type: Argument type, one of SLASH_ARG_XXX.
+ * @offset: Offset of the converted value in the argument struct.
+ * @range: Allowed range of SLASH_ARG_INT values.
+ * @urange: Allowed range of SLASH_ARG_HEX values.
+ * @frange: Allowed range of SLASH_ARG_FLOAT values.
+ * @values: NULL-terminated list of SLASH_ARG_ENUM values.
+ *
+ * This struct should only be instantiated using the SLASH_ARG_XXX() macros.
+ */
+struct slash_arg {
+	const char *name;
+	enum slash_arg_type type;
+	size_t offset;
+	union {
+		struct { long min, max; } range;
+		struct { unsigned long min, max; } urange;
+		struct { double min, max; } frange;
+		const char *const *values;
+	};
+};
+
+/**
+ * struct slash_schema - Argument schema of a command.
+ * @args: Positional arguments following the command name.
+ * @count: Number of arguments.
+ * @required: Number of arguments that must be given. The remaining arguments
+ * are optional.
+ * @size: Size of the argument struct.
+ *
+ * Commands with a schema get their arguments converted into a zero-initialized
+ * argument struct in slash->params before the function is called, and invalid
+ * arguments are reported without calling the function. The usage string is
+ * generated from the schema.
+ *
+ * This struct should only be instantiated using the slash_schema() macro.
+ */
+struct slash_schema {
+	const struct slash_arg *args;
+	unsigned int count;
+	unsigned int required;
+	size_t size;
+};
+
+/* Evaluate to offset of field, or fail to compile if it is not of type _type */
+#define __slash_arg_offset(_struct, _field, _type) \
+	(offsetof(_struct, _field) + 0 * sizeof(char[1 - 2 * \
+		!__builtin_types_compatible_p(__typeof__(((_struct *)0)->_field), _type)]))
+
+/**
+ * SLASH_ARG_INT() - Integer argument
+ * @_struct: Argument struct type.
+ * @_field: Field of type long in the argument struct.
+ * @_name: Name of the argument string.
+ * @_min: Minimum allowed value.
+ * @_max: Maximum allowed value.
+ */
+#define SLASH_ARG_INT(_struct, _field, _name, _min, _max) \
+	{ .name = _name, .type = SLASH_ARG_INT, \
+	  .offset = __slash_arg_offset(_struct, _field, long), \
+	  .range = { _min, _max } }
+
+/**
+ * SLASH_ARG_HEX() - Hexadecimal argument
+ * @_struct: Argument struct type.
+ * @_field: Field of type unsigned long in the argument struct.
+ * @_name: Name of the argument string.
+ * @_min: Minimum allowed value.
+ * @_max: Maximum allowed value.
+ */
+#define SLASH_ARG_HEX(_struct, _field, _name, _min, _max) \
+	{ .name = _name, .type = SLASH_ARG_HEX, \
+	  .offset = __slash_arg_offset(_struct, _field, unsigned long), \
+	  .urange = { _min, _max } }
+
+/**
+ * SLASH_ARG_FLOAT() - Floating point argument
+ * @_struct: Argument struct type.
+ * @_field: Field of type double in the argument struct.
+ * @_name: Name of the argument string.
+ * @_min: Minimum allowed value.
+ * @_max: Maximum allowed value.
+ */
+#define SLASH_ARG_FLOAT(_struct, _field, _name, _min, _max) \
+	{ .name = _name, .type = SLASH_ARG_FLOAT, \
+	  .offset = __slash_arg_offset(_struct, _field, double), \
+	  .frange = { _min, _max } }
+
+/**
+ * SLASH_ARG_ENUM() - Argument with one of a list of values
+ * @_struct: Argument struct type.
+ * @_field: Field of type int in the argument struct, set to the index of the
+ * value in the list.
+ * @_name: Name of the argument string.
+ * @_values: NULL-terminated array of allowed values.
+ */
+#define SLASH_ARG_ENUM(_struct, _field, _name, _values) \
+	{ .name = _name, .type = SLASH_ARG_ENUM, \
+	  .offset = __slash_arg_offset(_struct, _field, int), \
+	  .values = _values }
+
+/**
+ * SLASH_ARG_STRING() - String argument
+ * @_struct: Argument struct type.
+ * @_field: Field of type char * in the argument struct.
+ * @_name: Name of the argument string.
+ */
+#define SLASH_ARG_STRING(_struct, _field, _name) \
+	{ .name = _name, .type = SLASH_ARG_STRING, \
+	  .offset = __slash_arg_offset(_struct, _field, char *) }
+
+/**
+ * slash_schema() - Declare argument schema
+ * @_ident: Name of the schema variable.
+ * @_struct: Argument struct type the arguments are converted into.
+ * @_required: Number of required arguments, the rest are optional.
+ * @...: Arguments declared with the SLASH_ARG_XXX() macros.
+ *
+ * Pass a pointer to the schema as the args argument of the slash_command()
+ * macros, and read the converted arguments from slash->params.
+ */
+#define slash_schema(_ident, _struct, _required, ...) \
+	static const struct slash_arg _ident ## _args[] = { __VA_ARGS__ }; \
+	static const struct slash_schema _ident = { \
+		.args = _ident ## _args, \
+		.count = sizeof(_ident ## _args) / sizeof(_ident ## _args[0]), \
+		.required = _required, \
+		.size = sizeof(_struct), \
+	}
+
+/* Argument requirement of options */
+#define SLASH_OPT_NONE		0 /* Option takes no argument */
+#define SLASH_OPT_REQUIRED	1 /* Option requires an argument */
+#define SLASH_OPT_OPTIONAL	2 /* Option takes an optional, attached argument */
+
+/**
+ * struct slash_option - Command-line option.
+ * @name: Long option name without the leading dashes, or NULL.
+ * @val: Value returned by slash_getopt_long(). Values from 1 to 127 are
+ * also matched as short option characters.
+ * @has_arg: One of SLASH_OPT_NONE, SLASH_OPT_REQUIRED or SLASH_OPT_OPTIONAL.
+ */
+struct slash_option {
+	const char *name;
+	int val;
+	int has_arg;
+};
+
+/**
+ * struct slash_optable - Option lookup table.
+ * @options: Options of the table.
+ * @sorted: Indexes of the long options sorted by name.
+ * @count: Number of options, at most 255.
+ * @nlong: Number of long options.
+ * @ready: True when the lookup tables have been built.
+ * @shorts: One plus the index of each short option character, or 0.
+ *
+ * The lookup tables are built on first use, so finding an option does not
+ * depend on the number of options. This struct should only be instantiated
+ * using the slash_options() macro.
+ */
+struct slash_optable {
+	const struct slash_option *options;
+	uint8_t *sorted;
+	unsigned int count;
+	unsigned int nlong;
+	bool ready;
+	uint8_t shorts[128];
+};
+
+/**
+ * slash_options() - Declare option table
+ * @_ident: Name of the option table variable.
+ * @...: Options as struct slash_option initializers, e.g.
+ * {"verbose", 'v', SLASH_OPT_NONE}.
+ */
+#define slash_options(_ident, ...) \
+	static const struct slash_option _ident ## _options[] = { __VA_ARGS__ }; \
+	static uint8_t _ident ## _sorted[sizeof(_ident ## _options) / \
+					 sizeof(_ident ## _options[0])]; \
+	static struct slash_optable _ident = { \
+		.options = _ident ## _options, \
+		.sorted = _ident ## _sorted, \
+		.count = sizeof(_ident ## _options) / sizeof(_ident ## _options[0]), \
+	}
+
+/**
+ * struct slash_node - Command index entry.
+ * @command: Command described by this node, or NULL for the root node.
+ * @prefix: First four bytes of the command name, packed big-endian and zero
+ * padded, so comparing prefixes orders names like strcmp().
+ * @child: Index of first child node.
+ * @children: Number of child nodes.
+ * @namelen: Length of the command name.
+ *
+ * Node 0 is the root, and the remaining nodes are stored in breadth-first
+ * order with siblings sorted by name. The children of a node are thus a
+ * contiguous and sorted range that can be binary searched. The nodes hold
+ * the fields needed for lookup, so a search only touches the compact index
+ * and dereferences the command itself once a match is found.
+ *
+ * The index is built in RAM on first use, unless a matching read-only table
+ * has been generated at build time by tools/slashgen.py.
+ */
+struct slash_node {
+	struct slash_command *command;
+	uint32_t prefix;
+	uint16_t child;
+	uint16_t children;
+	uint8_t namelen;
+};
+
+/* Optional command index generated at build time by tools/slashgen.py */
+extern const struct slash_node slash_command_table[];
+extern const size_t slash_command_table_count;
+
+/**
+ * struct slash_view - Subset of commands visible in a console.
+ * @filter: Function returning true if a command should be visible.
+ * @arg: Argument passed to the filter function.
+ * @visible: Bitmap of visible commands over the command index.
+ * @generation: Index generation the bitmap was computed for.
+ *
+ * A command is visible if the filter accepts both the command and all of its
+ * parents. The filter is evaluated once per command when the view is first
+ * used and after the command index has changed, and the result is kept as a
+ * bitmap, so lookup and completion do not call the filter. A view can be
+ * shared by several consoles.
+ *
+ * This struct should be initialized using slash_view_init().
+ */
+struct slash_view {
+	slash_filter_t filter;
+	void *arg;
+	uint32_t *visible;
+	unsigned int generation;
+};
+
+/**
+ * struct slash_stats - Output statistics.
+ * @refreshes: Number of line refreshes.
+ * @writes: Number of writes to the I/O backend.
+ * @bytes: Number of bytes written to the I/O backend.
+ *
+ * The counters are never reset by slash, so the cost of a refresh can be found
+ * by sampling the counters before and after.
+ */
+struct slash_stats {
+	unsigned long refreshes;
+	unsigned long writes;
+	unsigned long bytes;
+};
+
 /**
  * struct slash_context - Slash context.
  * @original: Original termios structure for restoring terminal settings.
- * @file_write: File pointer used for output.
- * @file_read: File pointer used for input.
- * @waitfunc: Low-level function used for slash_wait_interruptible().
+ * @io: I/O backend.
+ * @io_arg: State of the I/O backend.
+ * @file_write: File pointer used for output by the stdio backend.
+ * @file_read: File pointer used for input by the stdio backend.
+ * @fd_write: File descriptor used for output by the fd backend.
+ * @fd_read: File descriptor used for input by the fd backend.
+ * @stdio_raw: Input of the stdio backend is a terminal in raw mode, which is
+ * read through its file descriptor.
+ * @input: Input read from the backend but not yet processed.
+ * @input_pos: Index of next unprocessed byte in input.
+ * @input_len: Number of valid bytes in input.
+ * @waitfunc: Low-level function used for slash_wait_interruptible(), or NULL
+ * to use the backend.
  * @use_activated: True if the console should require activation before use.
- * @privileged: True if the console is in privileged mode.
+ * @level: Current access level, one of SLASH_LEVEL_XXX.
  * @exit_inhibit: True if exit should be inhibited in this console.
+ * @abbreviate: True if commands may be abbreviated to a unique prefix.
  * @line_size: Size in bytes of the line buffer.
  * @prompt: Current prompt string.
  * @prompt_length: Length in bytes of the prompt string.
@@ -275,7 +734,13 @@ struct slash_command {
  * @change_start: Index of first byte in line buffer that needs screen refresh.
  * @change_end: Index of first byte in line buffer that does not need screen refresh.
  * @refresh_full: Force a full screen refresh including prompt.
+ * @shift_pos: Index in line buffer where characters were inserted or deleted.
+ * @shift: Number of characters inserted, or deleted if negative, at
+ * shift_pos since the last screen refresh.
  * @last_char: Last input character.
+ * @frame: Output of the current refresh, written to the backend at once.
+ * @frame_len: Number of valid bytes in frame.
+ * @stats: Output statistics.
  * @history_size: Size in byte of the history buffer.
  * @history_depth: Number of history entries browsed back.
  * @history_avail: Number of available bytes in history.
@@ -285,9 +750,28 @@ struct slash_command {
  * @history_head: Pointer to first byte of circular history buffer.
  * @history_tail: Pointer to last byte of circular history buffer.
  * @history_cursor: Current cursor when browsing history.
- * @argv: Argument vector passed to commands.
- * @argc: Number of valid arguments in argv.
+ * @view: Subset of commands visible in this console, or NULL for all.
+ * @spans: Arguments passed to commands as spans of the command line.
+ * @argv: Argument vector passed to commands, or NULL values for commands with
+ * SLASH_FLAG_SPANS.
+ * @argc: Number of valid arguments in spans and argv.
+ * @params: Arguments converted by the schema of the command, or NULL.
  * @context: Context pointer from command registration.
+ * @args_mem: Argument memory holding spans, argv and copies of arguments.
+ * @args_size: Size of argument memory.
+ * @args_end: Aligned end of argument memory.
+ * @args_top: Lowest byte allocated from the end of argument memory.
+ * @args_grow: Argument memory was allocated by slash_create() and can grow.
+ * @vars: Variable memory holding the variable records.
+ * @vars_size: Size of variable memory.
+ * @vars_used: Bytes used in variable memory.
+ * @var_hash: Offset plus one of the first variable in each hash bucket.
+ * @vars_alloc: Variable memory was allocated by slash_create().
+ * @paste: Paste memory holding the queued lines of a multi-line paste.
+ * @paste_size: Size of paste memory.
+ * @paste_pos: Offset of the next queued line.
+ * @paste_len: Bytes queued in paste memory.
+ * @paste_alloc: Paste memory was allocated by slash_create().
  * @optarg: Pointer to current option argument.
  * @optind: Index of the first non-option argument.
  * @opterr: Print warning on unknown option or missing argument.
@@ -299,12 +783,21 @@ struct slash {
 #ifdef SLASH_HAVE_TERMIOS_H
 	struct termios original;
 #endif
+	const struct slash_io *io;
+	void *io_arg;
 	FILE *file_write;
 	FILE *file_read;
+	int fd_write;
+	int fd_read;
+	bool stdio_raw;
+	char input[SLASH_INPUT_SIZE];
+	size_t input_pos;
+	size_t input_len;
 	slash_waitfunc_t waitfunc;
 	bool use_activate;
-	bool privileged;
+	unsigned int level;
 	bool exit_inhibit;
+	bool abbreviate;
 
 	/* Line editing */
 	size_t line_size;
@@ -318,7 +811,12 @@ struct slash {
 	size_t change_start;
 	size_t change_end;
 	bool refresh_full;
+	size_t shift_pos;
+	int shift;
 	char last_char;
+	char frame[SLASH_FRAME_SIZE];
+	size_t frame_len;
+	struct slash_stats stats;
 
 	/* History */
 	size_t history_size;
@@ -330,11 +828,35 @@ struct slash {
 	char *history_tail;
 	char *history_cursor;
 
-	/* Command interface (1 arg required for final NULL value) */
-	char *argv[SLASH_ARG_MAX + 1];
+	/* Command interface */
+	struct slash_view *view;
+	struct slash_span *spans;
+	char **argv;
 	int argc;
+	void *params;
 	void *context;
 
+	/* Argument memory */
+	char *args_mem;
+	size_t args_size;
+	char *args_end;
+	char *args_top;
+	bool args_grow;
+
+	/* Variables */
+	char *vars;
+	size_t vars_size;
+	size_t vars_used;
+	uint16_t var_hash[SLASH_VAR_BUCKETS];
+	bool vars_alloc;
+
+	/* Bracketed paste */
+	char *paste;
+	size_t paste_size;
+	size_t paste_pos;
+	size_t paste_len;
+	bool paste_alloc;
+
 	/* getopt state */
 	char *optarg;
 	int optind;
@@ -343,6 +865,36 @@ struct slash {
 	int sp;
 };
 
+/**
+ * struct slash_prepared - Prepared command line.
+ * @command: Command to execute, or NULL if the line was empty.
+ * @node: Index of the command in the command index.
+ * @generation: Index generation when @node was found.
+ * @argc: Number of arguments.
+ * @used: Number of bytes used in @scratch.
+ * @argv: Offset of the argument vector in @scratch.
+ * @params: Offset plus one of the converted schema arguments in @scratch, or 0.
+ * @offset: Offset of each argument in @scratch.
+ * @length: Length of each argument.
+ * @scratch: NUL-terminated arguments and converted schema arguments.
+ *
+ * The struct holds no pointers to itself, so it may be copied. String
+ * arguments in the converted schema arguments are pointed at the copied
+ * arguments by slash_run().
+ */
+struct slash_prepared {
+	struct slash_command *command;
+	unsigned int node;
+	unsigned int generation;
+	int argc;
+	size_t used;
+	size_t argv;
+	size_t params;
+	unsigned short offset[SLASH_ARG_MAX];
+	unsigned short length[SLASH_ARG_MAX];
+	char scratch[SLASH_SCRATCH_SIZE] __attribute__((aligned));
+};
+
 /**
  * slash_create() - Allocate slash context and buffers.
  * @line_size: Number of bytes to allocate for the line buffer.
@@ -373,16 +925,91 @@ void slash_destroy(struct slash *slash);
  * @line_size: Size in bytes of the line buffer.
  * @history: Pointer to history buffer.
  * @history_size: Size in bytes of the history buffer.
+ * @args: Pointer to argument memory.
+ * @args_size: Size in bytes of the argument memory.
+ *
+ * This command initializes a slash context and buffers. The first call also
+ * builds the shared command index used for lookup and completion.
  *
- * This command initializes a slash context and buffers.
+ * The argument memory holds the spans, argv and NUL-terminated copies of the
+ * arguments of the executing command, so its size limits the number and
+ * length of arguments. On 64-bit targets, each argument uses 24 bytes plus
+ * its length including the NUL terminator, and the command name counts as an
+ * argument. Contexts allocated with slash_create() start with SLASH_ARGS_SIZE
+ * bytes that grow as needed.
  *
  * Return: 0 if the initialization was successful, negative error value otherwise.
  */
 int slash_init(struct slash *slash,
 	       char *line, size_t line_size,
-	       char *history, size_t history_size);
+	       char *history, size_t history_size,
+	       char *args, size_t args_size);
 
 
+/**
+ * slash_command_register() - Register command at runtime.
+ * @command: Command to register.
+ *
+ * Adds a command that was created at runtime, e.g. from a device description.
+ * Registered commands are dispatched, listed, completed and checked for
+ * privileges exactly like commands declared with the slash_command() macros.
+ * The parent must be NULL, a command declared with the macros, or a command
+ * that is already registered. The namelen member may be left as 0.
+ *
+ * The command and the strings it points to must remain valid until it is
+ * unregistered. The command index shared by all contexts is rebuilt before
+ * returning. Registration does no locking, so it must not run while another
+ * thread uses any slash context, and neither must the first apropos command,
+ * which builds the shared keyword index.
+ *
+ * Return: 0 on success, -EINVAL if the command has no name or an unknown
+ * parent, -EEXIST if it is already registered or its parent already has a
+ * command of the same name, -ENAMETOOLONG, -E2BIG if the index is full, or
+ * -ENOMEM.
+ */
+int slash_command_register(struct slash_command *command);
+
+/**
+ * slash_command_unregister() - Unregister command added at runtime.
+ * @command: Command to unregister.
+ *
+ * The command index is rebuilt before returning, and the same locking rules
+ * apply as for slash_command_register(). If the index cannot be rebuilt, the
+ * command stays registered.
+ *
+ * Return: 0 on success, -ENOENT if the command is not registered, -EBUSY if
+ * registered commands still have this command as parent, or -ENOMEM.
+ */
+int slash_command_unregister(struct slash_command *command);
+
+/**
+ * slash_view_init() - Initialize command view.
+ * @view: View to initialize.
+ * @filter: Function returning true if a command should be visible.
+ * @arg: Argument passed to the filter function.
+ *
+ * Return: 0 on success, or -EINVAL if no filter is given.
+ */
+int slash_view_init(struct slash_view *view, slash_filter_t filter, void *arg);
+
+/**
+ * slash_view_destroy() - Free memory used by command view.
+ * @view: View to free memory of.
+ *
+ * The view must not be in use by any console.
+ */
+void slash_view_destroy(struct slash_view *view);
+
+/**
+ * slash_set_view() - Restrict console to a subset of commands.
+ * @slash: slash context.
+ * @view: View of visible commands, or NULL to show all commands.
+ *
+ * Commands outside the view can not be executed, and are not shown in help
+ * or completion.
+ */
+void slash_set_view(struct slash *slash, struct slash_view *view);
+
 /**
  * slash_refresh() - Write current line buffer to terminal.
  * @slash: slash context.
@@ -397,6 +1024,63 @@ int slash_refresh(struct slash *slash);
  */
 void slash_reset(struct slash *slash);
 
+/**
+ * slash_set_variable_memory() - Set memory for variables.
+ * @slash: slash context.
+ * @buffer: Buffer to hold the variables.
+ * @size: Size of the buffer in bytes, at most 65535 bytes are used.
+ *
+ * Variables set with the set builtin or slash_set_variable() are stored in
+ * this buffer, so variables never allocate memory. Each variable uses four
+ * bytes plus the lengths of its name and value, each including a NUL
+ * terminator. Contexts allocated with slash_create() get SLASH_VARS_SIZE bytes
+ * of variable memory, which is freed when replaced by this call. Any existing
+ * variables are removed.
+ */
+void slash_set_variable_memory(struct slash *slash, char *buffer, size_t size);
+
+/**
+ * slash_set_paste_memory() - Set memory for queued paste lines.
+ * @slash: slash context.
+ * @buffer: Buffer to hold the queued lines, or NULL.
+ * @size: Size of the buffer in bytes.
+ *
+ * Text pasted in a terminal with bracketed paste is inserted in the line
+ * without interpreting control keys. When the paste holds more than one line,
+ * the lines after the first are queued in this buffer and returned by the
+ * following calls to slash_readline(), so no line is executed before the paste
+ * is complete. Lines that do not fit are discarded. Contexts allocated with
+ * slash_create() get SLASH_PASTE_SIZE bytes of paste memory, which is freed
+ * when replaced by this call.
+ */
+void slash_set_paste_memory(struct slash *slash, char *buffer, size_t size);
+
+/**
+ * slash_set_variable() - Set or remove variable.
+ * @slash: slash context.
+ * @name: Name of the variable, consisting of letters, digits and '_'.
+ * @value: Value of the variable, or NULL to remove it.
+ *
+ * Variables are expanded in command arguments that are not in single quotes,
+ * using $name or ${name}. A variable used as a whole argument is passed to
+ * the command without being copied.
+ *
+ * Return: 0 on success, -EINVAL if the name is invalid, -E2BIG if the name or
+ * value is longer than 255 bytes, -ENOSPC if the variable memory is full,
+ * or -ENOENT if a variable to remove was not set.
+ */
+int slash_set_variable(struct slash *slash, const char *name, const char *value);
+
+/**
+ * slash_get_variable() - Get value of variable.
+ * @slash: slash context.
+ * @name: Name of the variable.
+ *
+ * Return: The value of the variable, or NULL if it is not set. The value is
+ * valid until the next variable is set or removed.
+ */
+const char *slash_get_variable(struct slash *slash, const char *name);
+
 /**
  * slash_set_prompt() - Set prompt
  * @slash: slash context.
@@ -415,15 +1099,83 @@ char *slash_readline(struct slash *slash);
 /**
  * slash_execute() - Execute command.
  * @slash: slash context.
- * @line: Buffer with command line to execute.
+ * @line: Command line to execute.
  *
- * Return: Return value from executed command, or
+ * The command line is not modified, so it may reside in read-only memory.
+ * The line may hold a list of commands separated by ';', '&&' or '||'. The
+ * command after '&&' is only executed if the previous command returned
+ * SLASH_SUCCESS, and the command after '||' only if it did not. A command
+ * returning SLASH_EXIT ends the list.
+ *
+ * Return: Return value from the last executed command, or
  * -ENOENT if the command could not be found, or
  * -EISDIR if the command is a group, or
  * -EINVAL if the command contained mismatched quotes, or
- * -E2BIG if the command contained too many arguments
+ * -E2BIG if the command contained too many arguments, or
+ * -ENOSPC if the arguments did not fit in the argument memory
+ */
+int slash_execute(struct slash *slash, const char *line);
+
+/**
+ * slash_execute_len() - Execute command that is not NUL-terminated.
+ * @slash: slash context.
+ * @line: Command line to execute.
+ * @len: Length of command line in bytes.
+ *
+ * Same as slash_execute(), but for command lines that are not NUL-terminated,
+ * such as lines in a memory mapped script.
+ *
+ * Return: See slash_execute().
  */
-int slash_execute(struct slash *slash, char *line);
+int slash_execute_len(struct slash *slash, const char *line, size_t len);
+
+/**
+ * slash_execute_argv() - Execute command from argument vector.
+ * @slash: slash context.
+ * @argc: Number of arguments.
+ * @argv: Command path and arguments, e.g. {"test", "sub", "arg"}.
+ *
+ * Same as slash_execute(), but for front ends that have already split the
+ * command line. The command path is resolved from the leading arguments, and
+ * the remaining arguments are passed to the command without being copied.
+ *
+ * Return: See slash_execute().
+ */
+int slash_execute_argv(struct slash *slash, int argc, char **argv);
+
+/**
+ * slash_prepare() - Prepare command line for repeated execution.
+ * @slash: slash context.
+ * @prepared: Prepared command to initialize.
+ * @line: Command line to prepare.
+ *
+ * Finds the command and splits and converts the arguments once, so the
+ * command can be executed many times with slash_run() without parsing the
+ * line again. Errors are reported as by slash_execute(), but the command is
+ * not called. The argument memory of the context is used while preparing, and
+ * prepared commands are limited to SLASH_ARG_MAX arguments using at most
+ * SLASH_SCRATCH_SIZE bytes of argument memory.
+ * Command lists cannot be prepared.
+ *
+ * Return: 0 on success, -EINVAL for command lists, or an error code as
+ * returned by slash_execute().
+ */
+int slash_prepare(struct slash *slash, struct slash_prepared *prepared,
+		  const char *line);
+
+/**
+ * slash_run() - Execute prepared command.
+ * @slash: slash context.
+ * @prepared: Command prepared with slash_prepare().
+ *
+ * The command receives a fresh copy of the prepared arguments on each call.
+ * If the command has been unregistered, or is no longer visible in the view
+ * or at the access level of the context, it is not called.
+ *
+ * Return: Return value from executed command, 0 if the prepared line was
+ * empty, or -ENOENT if the command could not be found.
+ */
+int slash_run(struct slash *slash, struct slash_prepared *prepared);
 
 /**
  * slash_loop() - Continuously read and execute commands.
@@ -439,10 +1191,60 @@ int slash_loop(struct slash *slash);
  * @slash: slash context.
  * @ms: Maximum number of milliseconds to wait.
  *
- * Return: return valid from waitfunc or -ENOSYS if no waitfunc has been specified.
+ * Return: return valid from waitfunc or the backend, or -ENOSYS if neither
+ * supports waiting.
  */
 int slash_wait_interruptible(struct slash *slash, unsigned int ms);
 
+/**
+ * slash_set_io() - Set I/O backend.
+ * @slash: slash context.
+ * @io: I/O backend, e.g. &slash_io_stdio or &slash_io_fd.
+ * @arg: State of the backend, available to it as slash->io_arg.
+ *
+ * Contexts use the stdio backend on stdin and stdout after initialization.
+ * The fd backend uses slash->fd_read and slash->fd_write, which are
+ * initialized to the standard input and output, and bypasses the stdio
+ * buffering and locking. Buffered input is discarded.
+ */
+void slash_set_io(struct slash *slash, const struct slash_io *io, void *arg);
+
+/**
+ * slash_ring_init() - Initialize transmit ring.
+ * @ring: Ring to initialize.
+ * @buffer: Ring buffer memory.
+ * @size: Size of the buffer in bytes, must be a power of 2.
+ * @policy: SLASH_RING_BLOCK, SLASH_RING_DROP or SLASH_RING_YIELD.
+ * @input: Backend used for input, or NULL.
+ *
+ * The start and yield functions and the driver state can be set in the struct
+ * after initialization. Use slash_set_io() with slash_io_ring and the ring to
+ * send the output of a context through the ring.
+ *
+ * Return: 0 on success, or -EINVAL if the size or policy is invalid.
+ */
+int slash_ring_init(struct slash_ring *ring, char *buffer, size_t size,
+		    int policy, const struct slash_io *input);
+
+/**
+ * slash_ring_peek() - Get next contiguous block of output.
+ * @ring: Transmit ring.
+ * @data: Set to the start of the block.
+ *
+ * Called by the driver, possibly from interrupt context. The block stays valid
+ * until it is released with slash_ring_consume().
+ *
+ * Return: Number of bytes in the block, or 0 if the ring is empty.
+ */
+size_t slash_ring_peek(struct slash_ring *ring, const char **data);
+
+/**
+ * slash_ring_consume() - Release transmitted output.
+ * @ring: Transmit ring.
+ * @count: Number of bytes sent, at most the size of the last peeked block.
+ */
+void slash_ring_consume(struct slash_ring *ring, size_t count);
+
 /**
  * slash_set_wait_interruptible() - Set wait function.
  * @slash: slash context.
@@ -461,13 +1263,40 @@ int slash_set_wait_interruptible(struct slash *slash, slash_waitfunc_t waitfunc)
  * @slash: slash context.
  * @format: Format string.
  *
- * This function prints formatted string to the output file pointer.
+ * This function prints formatted string to the I/O backend of the context.
+ * With the stdio backend, the output is formatted by vfprintf(), unless slash
+ * is built with SLASH_BUILTIN_PRINTF. Otherwise the built-in formatter is used,
+ * which does not allocate memory and writes the output to the backend in
+ * pieces of SLASH_PRINTF_SIZE bytes. It supports the flags, field width,
+ * precision and length modifiers of printf for the d, i, u, x, X, o, c, s, p,
+ * e, E, f, F, g, G and % conversions. Floating point values are converted
+ * exactly and rounded to nearest, with ties to even.
  *
- * Return: This function is just a wrapper around printf and thus has the same
- * return value.
+ * Return: Number of characters printed, or a negative value if vfprintf() fails.
  */
 int slash_printf(struct slash *slash, const char *format, ...);
 
+/**
+ * slash_vprintf() - Print formatted data with argument list.
+ * @slash: slash context.
+ * @format: Format string.
+ * @args: Arguments for the format string.
+ *
+ * Return: Number of characters printed, or a negative value if vfprintf() fails.
+ */
+int slash_vprintf(struct slash *slash, const char *format, va_list args);
+
+/**
+ * slash_snprintf() - Format data into buffer with the built-in formatter.
+ * @buf: Output buffer.
+ * @size: Size of the output buffer, including the NUL terminator.
+ * @format: Format string, as for slash_printf().
+ *
+ * Return: Length of the formatted string, which was truncated if this is not
+ * less than @size.
+ */
+int slash_snprintf(char *buf, size_t size, const char *format, ...);
+
 /**
  * slash_getop() - Parse command-line options
  * @slash: slash context.
@@ -483,6 +1312,24 @@ int slash_printf(struct slash *slash, const char *format, ...);
  */
 int slash_getopt(struct slash *slash, const char *optstring);
 
+/**
+ * slash_getopt_long() - Parse command-line options using an option table
+ * @slash: slash context.
+ * @table: Option table declared with slash_options().
+ * @longindex: Set to the index of the found option in the table, or NULL.
+ *
+ * Like slash_getopt(), but options are looked up in a table and long options
+ * are supported. Long options are given as --name, --name=value or, for
+ * options with required arguments, --name value, and may be abbreviated to
+ * a unique prefix.
+ *
+ * Return: For each found option, the val field of the option is returned. If
+ * an unknown or ambiguous option is found, or an option is missing an
+ * argument, '?' is returned. When no more options are found, -1 is returned.
+ */
+int slash_getopt_long(struct slash *slash, struct slash_optable *table,
+		      int *longindex);
+
 /**
  * slash_clear_screen() - Clear the screen.
  * @slash: slash context.
@@ -509,7 +1356,36 @@ void slash_inhibit_exit(struct slash *slash, bool inhibit);
  * slash_set_privileged() - Set current privileged level.
  * @slash: slash context.
  * @activate: Set to true to allow privileged commands.
+ *
+ * Enabling privileged mode sets the highest access level, and disabling it
+ * sets the lowest level.
  */
 void slash_set_privileged(struct slash *slash, bool privileged);
 
+/**
+ * slash_set_level() - Set current access level.
+ * @slash: slash context.
+ * @level: Access level, one of SLASH_LEVEL_XXX.
+ *
+ * Commands flagged with SLASH_FLAG_LEVEL() of a higher level than the current
+ * are hidden and cannot be executed. SLASH_FLAG_PRIVILEGED is the same as
+ * SLASH_FLAG_LEVEL(SLASH_LEVEL_ENGINEER).
+ *
+ * Return: 0 on success, -EINVAL if the level is invalid.
+ */
+int slash_set_level(struct slash *slash, unsigned int level);
+
+/**
+ * slash_set_abbreviate() - Allow abbreviated command names.
+ * @slash: slash context.
+ * @abbreviate: Set to true to accept unique prefixes of command names.
+ *
+ * Abbreviations are disabled by default, so adding a command cannot make
+ * scripts that use a shortened name ambiguous. When enabled, each word of a
+ * command path may be shortened to a prefix that matches only one command
+ * shown in completion, and ambiguous prefixes are reported together with the
+ * matching commands.
+ */
+void slash_set_abbreviate(struct slash *slash, bool abbreviate);
+
 #endif /* _SLASH_H_ */
@@ -21,6 +21,10 @@
  * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 
+#ifdef SLASH_HAVE_DL_ITERATE_PHDR
+#define _GNU_SOURCE
+#endif
+
 #include <slash/slash.h>
 
 #include <stdio.h>
@@ -33,7 +37,6 @@
 #include <unistd.h>
 #include <ctype.h>
 #include <errno.h>
-#include <fcntl.h>
 
 #ifdef SLASH_HAVE_TERMIOS_H
 #include <termios.h>
@@ -43,6 +46,20 @@
 #include <sys/select.h>
 #endif
 
+#ifdef SLASH_HAVE_DL_ITERATE_PHDR
+#include <link.h>
+#include <dlfcn.h>
+#endif
+
+/* Vector instructions for line scanning, unless disabled with SLASH_NO_SIMD */
+#if !defined(SLASH_NO_SIMD) && defined(__AVX2__)
+#include <immintrin.h>
+#define SLASH_SCAN_AVX2
+#elif !defined(SLASH_NO_SIMD) && defined(__SSE2__)
+#include <emmintrin.h>
+#define SLASH_SCAN_SSE2
+#endif
+
 /* Terminal codes */
 #define ESC '\x1b'
 #define DEL '\x7f'
@@ -59,69 +76,294 @@ extern struct slash_command __stop_slash;
 	     cmd < &__stop_slash;		\
 	     cmd++)
 
+/* Command index, either generated at build time or built in RAM */
+extern const struct slash_node slash_command_table[] __attribute__((weak));
+extern const size_t slash_command_table_count __attribute__((weak));
+
+static const struct slash_node *slash_nodes;
+static struct slash_node *slash_nodes_ram;
+static size_t slash_node_count;
+
+/* Incremented on every index build to invalidate views */
+static unsigned int slash_index_generation;
+
+/* Bitmaps of nodes shown in help and completion, one per access level */
+static uint32_t *slash_level_shown;
+
+struct slash_keyword {
+	uint32_t hash;
+	uint16_t node;
+};
+
+/* Inverted index of words in command names, arguments and help, built by
+ * the first apropos and rebuilt with the command index */
+static struct slash_keyword *slash_keywords;
+static size_t slash_keyword_count;
+static unsigned int slash_keyword_generation;
+
+static int slash_keyword_build(void);
+
+#define slash_bitmap_words(bits) (((bits) + 31) / 32)
+#define slash_bit_test(map, bit) ((map)[(bit) / 32] & (1UL << ((bit) % 32)))
+#define slash_bit_set(map, bit) ((map)[(bit) / 32] |= (1UL << ((bit) % 32)))
+
+#define slash_command_level(cmd) \
+	(((cmd)->flags & SLASH_FLAG_LEVEL_MASK) >> SLASH_FLAG_LEVEL_SHIFT)
+
+/* Command table of a loaded object */
+struct slash_table {
+	struct slash_command *start;
+	struct slash_command *stop;
+};
+
+#define slash_node_root() (&slash_nodes[0])
+
+#define slash_node_for_each_child(node, parent)			\
+	for (node = &slash_nodes[(parent)->child];		\
+	     node < &slash_nodes[(parent)->child + (parent)->children]; \
+	     node++)
+
 /* Command-line option parsing */
-int slash_getopt(struct slash *slash, const char *opts)
+static bool slash_getopt_next(struct slash *slash)
 {
-	/* From "public domain AT&T getopt source" newsgroup posting */
-	int c;
-	char *cp;
+	if (slash->optind >= slash->argc ||
+	    slash->argv[slash->optind][0] != '-' ||
+	    slash->argv[slash->optind][1] == '\0') {
+		return false;
+	} else if (!strcmp(slash->argv[slash->optind], "--")) {
+		slash->optind++;
+		return false;
+	}
 
-	if (slash->sp == 1) {
-		if (slash->optind >= slash->argc ||
-		    slash->argv[slash->optind][0] != '-' ||
-		    slash->argv[slash->optind][1] == '\0') {
-			return EOF;
-		} else if (!strcmp(slash->argv[slash->optind], "--")) {
-			slash->optind++;
-			return EOF;
-		}
+	return true;
+}
+
+static int slash_getopt_unknown(struct slash *slash, int c)
+{
+	if (slash->opterr)
+		slash_printf(slash, "Unknown option -%c\n", c);
+	if (slash->argv[slash->optind][++(slash->sp)] == '\0') {
+		slash->optind++;
+		slash->sp = 1;
 	}
 
-	slash->optopt = c = slash->argv[slash->optind][slash->sp];
+	return '?';
+}
 
-	if (c == ':' || (cp = strchr(opts, c)) == NULL) {
-		if (slash->opterr)
-			slash_printf(slash, "Unknown option -%c\n", c);
-		if (slash->argv[slash->optind][++(slash->sp)] == '\0') {
-			slash->optind++;
+static int slash_getopt_short(struct slash *slash, int c, int has_arg)
+{
+	char *arg = slash->argv[slash->optind];
+
+	slash->optarg = NULL;
+	if (has_arg == SLASH_OPT_NONE) {
+		if (arg[++(slash->sp)] == '\0') {
 			slash->sp = 1;
+			slash->optind++;
 		}
+		return c;
+	}
+
+	if (arg[slash->sp + 1] != '\0') {
+		slash->optarg = &arg[slash->sp + 1];
+		slash->optind++;
+	} else if (has_arg == SLASH_OPT_OPTIONAL) {
+		/* Optional arguments must be attached to the option */
+		slash->optind++;
+	} else if (++(slash->optind) >= slash->argc) {
+		if (slash->opterr)
+			slash_printf(slash, "Option -%c requires an argument\n", c);
+		slash->sp = 1;
 		return '?';
+	} else {
+		slash->optarg = slash->argv[(slash->optind)++];
+	}
+	slash->sp = 1;
+
+	return c;
+}
+
+/* Find long option by name or unique prefix */
+static const struct slash_option *
+slash_optable_find(struct slash *slash, const struct slash_optable *table,
+		   const char *name, size_t len)
+{
+	const struct slash_option *opt, *next;
+	unsigned int low = 0, high = table->nlong, mid;
+
+	/* Find first long option not ordered before the name */
+	while (low < high) {
+		mid = low + (high - low) / 2;
+		opt = &table->options[table->sorted[mid]];
+		if (strncmp(opt->name, name, len) < 0)
+			low = mid + 1;
+		else
+			high = mid;
 	}
 
-	if (*(++cp) == ':') {
-		if (slash->argv[slash->optind][slash->sp+1] != '\0') {
-			slash->optarg = &slash->argv[(slash->optind)++][slash->sp+1];
-		} else if(++(slash->optind) >= slash->argc) {
+	if (low == table->nlong)
+		goto unknown;
+
+	opt = &table->options[table->sorted[low]];
+	if (strncmp(opt->name, name, len))
+		goto unknown;
+
+	/* Exact match sorts before longer names with the same prefix */
+	if (opt->name[len] == '\0')
+		return opt;
+
+	if (low + 1 < table->nlong) {
+		next = &table->options[table->sorted[low + 1]];
+		if (!strncmp(next->name, name, len)) {
 			if (slash->opterr)
-				slash_printf(slash, "Option -%c requires an argument\n", c);
-			slash->sp = 1;
+				slash_printf(slash, "Ambiguous option --%.*s\n",
+					     (int)len, name);
+			return NULL;
+		}
+	}
+
+	return opt;
+
+unknown:
+	if (slash->opterr)
+		slash_printf(slash, "Unknown option --%.*s\n", (int)len, name);
+	return NULL;
+}
+
+static void slash_optable_build(struct slash_optable *table)
+{
+	const struct slash_option *opt;
+	unsigned int i, j;
+	uint8_t index;
+
+	memset(table->shorts, 0, sizeof(table->shorts));
+	table->nlong = 0;
+
+	for (i = 0; i < table->count; i++) {
+		opt = &table->options[i];
+		if (opt->val > 0 && opt->val < (int)sizeof(table->shorts))
+			table->shorts[opt->val] = i + 1;
+		if (!opt->name)
+			continue;
+
+		/* Insertion sort, the tables are small and built once */
+		index = i;
+		for (j = table->nlong; j > 0; j--) {
+			if (strcmp(table->options[table->sorted[j - 1]].name,
+				   opt->name) <= 0)
+				break;
+			table->sorted[j] = table->sorted[j - 1];
+		}
+		table->sorted[j] = index;
+		table->nlong++;
+	}
+
+	table->ready = true;
+}
+
+static int slash_getopt_longopt(struct slash *slash,
+				const struct slash_optable *table,
+				char *name, int *longindex)
+{
+	const struct slash_option *opt;
+	char *value;
+	size_t len;
+
+	value = strchr(name, '=');
+	len = value ? (size_t)(value - name) : strlen(name);
+
+	slash->optind++;
+	slash->optarg = NULL;
+
+	opt = slash_optable_find(slash, table, name, len);
+	if (!opt)
+		return '?';
+
+	slash->optopt = opt->val;
+	if (longindex)
+		*longindex = opt - table->options;
+
+	if (value) {
+		if (opt->has_arg == SLASH_OPT_NONE) {
+			if (slash->opterr)
+				slash_printf(slash, "Option --%s does not take an argument\n",
+					     opt->name);
 			return '?';
-		} else {
-			slash->optarg = slash->argv[(slash->optind)++];
 		}
-		slash->sp = 1;
-	} else {
-		if (slash->argv[slash->optind][++(slash->sp)] == '\0') {
-			slash->sp = 1;
-			slash->optind++;
+		slash->optarg = value + 1;
+	} else if (opt->has_arg == SLASH_OPT_REQUIRED) {
+		if (slash->optind >= slash->argc) {
+			if (slash->opterr)
+				slash_printf(slash, "Option --%s requires an argument\n",
+					     opt->name);
+			return '?';
 		}
-		slash->optarg = NULL;
+		slash->optarg = slash->argv[(slash->optind)++];
 	}
 
-	return c;
+	return opt->val;
 }
 
-/* Terminal handling */
-static int slash_rawmode_enable(struct slash *slash)
+int slash_getopt_long(struct slash *slash, struct slash_optable *table,
+		      int *longindex)
+{
+	const struct slash_option *opt;
+	unsigned int i = 0;
+	int c;
+
+	if (!table->ready)
+		slash_optable_build(table);
+
+	if (slash->sp == 1) {
+		if (!slash_getopt_next(slash))
+			return EOF;
+		if (slash->argv[slash->optind][1] == '-')
+			return slash_getopt_longopt(slash, table,
+						    &slash->argv[slash->optind][2],
+						    longindex);
+	}
+
+	slash->optopt = c = (unsigned char)slash->argv[slash->optind][slash->sp];
+	if (c < (int)sizeof(table->shorts))
+		i = table->shorts[c];
+	if (!i)
+		return slash_getopt_unknown(slash, c);
+
+	opt = &table->options[i - 1];
+	if (longindex)
+		*longindex = i - 1;
+
+	return slash_getopt_short(slash, c, opt->has_arg);
+}
+
+int slash_getopt(struct slash *slash, const char *opts)
 {
+	/* Based on "public domain AT&T getopt source" newsgroup posting */
+	int c;
+	char *cp;
+
+	if (slash->sp == 1 && !slash_getopt_next(slash))
+		return EOF;
+
+	slash->optopt = c = slash->argv[slash->optind][slash->sp];
+
+	if (c == ':' || (cp = strchr(opts, c)) == NULL)
+		return slash_getopt_unknown(slash, c);
+
+	return slash_getopt_short(slash, c, cp[1] == ':' ?
+				  SLASH_OPT_REQUIRED : SLASH_OPT_NONE);
+}
+
+/* Terminal handling */
 #ifdef SLASH_HAVE_TERMIOS_H
-	int fd = fileno(slash->file_read);
+static int slash_termios_rawmode(struct slash *slash, int fd, bool enable)
+{
+	struct termios raw;
 
 	if (!isatty(fd))
 		return 0;
 
-	struct termios raw;
+	if (!enable)
+		return tcsetattr(fd, TCSANOW, &slash->original) < 0 ? -ENOTTY : 0;
 
 	if (tcgetattr(fd, &slash->original) < 0)
 		return -ENOTTY;
@@ -134,35 +376,33 @@ static int slash_rawmode_enable(struct slash *slash)
 
 	if (tcsetattr(fd, TCSANOW, &raw) < 0)
 		return -ENOTTY;
-#endif
-	return 0;
-}
-
-static int slash_rawmode_disable(struct slash *slash)
-{
-#ifdef SLASH_HAVE_TERMIOS_H
-	int fd = fileno(slash->file_read);
 
-	if (!isatty(fd))
-		return 0;
-
-	if (tcsetattr(fd, TCSANOW, &slash->original) < 0)
-		return -ENOTTY;
-#endif
 	return 0;
 }
+#endif
 
 static int slash_configure_term(struct slash *slash)
 {
-	if (slash_rawmode_enable(slash) < 0)
+	const char *esc = ESCAPE("?2004h");
+
+	if (slash->io->rawmode && slash->io->rawmode(slash, true) < 0)
 		return -ENOTTY;
 
+	/* Enable bracketed paste, terminals without support ignore this */
+	slash->io->write(slash, esc, strlen(esc));
+
 	return 0;
 }
 
 static int slash_restore_term(struct slash *slash)
 {
-	if (slash_rawmode_disable(slash) < 0)
+	const char *esc = ESCAPE("?2004l");
+
+	slash->io->write(slash, esc, strlen(esc));
+	if (slash->io->flush)
+		slash->io->flush(slash);
+
+	if (slash->io->rawmode && slash->io->rawmode(slash, false) < 0)
 		return -ENOTTY;
 
 	return 0;
@@ -170,279 +410,2791 @@ static int slash_restore_term(struct slash *slash)
 
 static int slash_write(struct slash *slash, const char *buf, size_t count)
 {
-	return fwrite(buf, 1, count, slash->file_write) == count ? (int)count : -1;
+	slash->stats.writes++;
+	slash->stats.bytes += count;
+
+	return slash->io->write(slash, buf, count);
 }
 
 static int slash_write_flush(struct slash *slash)
 {
-	return fflush(slash->file_write) == 0 ? 0 : -1;
+	return slash->io->flush ? slash->io->flush(slash) : 0;
 }
 
-static int slash_read(struct slash *slash, void *buf, size_t count)
+static int slash_putchar(struct slash *slash, char c)
 {
-	return fread(buf, 1, count, slash->file_read) == count ? (int)count : -1;
+	return slash_write(slash, &c, 1);
 }
 
-static int slash_putchar(struct slash *slash, char c)
+/* Frame buffer to collect the output of a refresh into a single write */
+static int slash_frame_emit(struct slash *slash)
 {
-	return slash_write(slash, &c, 1);
+	int ret = 0;
+
+	if (slash->frame_len) {
+		ret = slash_write(slash, slash->frame, slash->frame_len);
+		slash->frame_len = 0;
+	}
+
+	return ret < 0 ? -EIO : 0;
 }
 
-static int slash_getchar(struct slash *slash)
+static int slash_frame_write(struct slash *slash, const char *buf, size_t count)
 {
-	unsigned char c;
+	size_t n;
+
+	while (count) {
+		/* Output larger than the frame is written in pieces */
+		if (slash->frame_len == sizeof(slash->frame) &&
+		    slash_frame_emit(slash) < 0)
+			return -EIO;
+
+		n = sizeof(slash->frame) - slash->frame_len;
+		if (n > count)
+			n = count;
+		memcpy(&slash->frame[slash->frame_len], buf, n);
+		slash->frame_len += n;
+		buf += n;
+		count -= n;
+	}
 
-	if (slash_read(slash, &c, 1) < 1)
-		return -EIO;
+	return 0;
+}
 
-	return c;
+static int slash_frame_putchar(struct slash *slash, char c)
+{
+	return slash_frame_write(slash, &c, 1);
 }
 
-static void slash_mark_changed(struct slash *slash, size_t start, size_t end)
+static int slash_getchar(struct slash *slash)
 {
-	if (slash->change_start == slash->change_end) {
-		slash->change_start = start;
-		slash->change_end = end;
-	} else {
-		if (start < slash->change_start)
-			slash->change_start = start;
-		if (end > slash->change_end)
-			slash->change_end = end;
+	int ret;
+
+	/* Refill input buffer with the bytes the backend has available */
+	if (slash->input_pos == slash->input_len) {
+		ret = slash->io->read(slash, slash->input, sizeof(slash->input));
+		if (ret < 1)
+			return -EIO;
+		slash->input_pos = 0;
+		slash->input_len = ret;
 	}
+
+	return (unsigned char)slash->input[slash->input_pos++];
+}
+
+static bool slash_input_pending(struct slash *slash)
+{
+	return slash->input_pos < slash->input_len;
 }
 
 #ifdef SLASH_HAVE_SELECT
-static int slash_wait_select(struct slash *slash, unsigned int ms)
+static int slash_select_wait(struct slash *slash, int fd, unsigned int ms)
 {
-	int ret = -ETIMEDOUT, fd;
-	char c;
+	int ret = -ETIMEDOUT;
 	fd_set fds;
 	struct timeval timeout;
 
 	timeout.tv_sec = ms / 1000;
 	timeout.tv_usec = (ms - timeout.tv_sec * 1000) * 1000;
 
-	fd = fileno(slash->file_read);
 	FD_ZERO(&fds);
 	FD_SET(fd, &fds);
 
-	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) |  O_NONBLOCK);
-
-	ret = select(1, &fds, NULL, NULL, &timeout);
-	if (ret == 1) {
-		slash_read(slash, &c, 1);
-		ret = (unsigned char)c;
-	}
-
-	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+	/* The descriptor is readable, so the read does not block */
+	ret = select(fd + 1, &fds, NULL, NULL, &timeout);
+	if (ret == 1)
+		ret = slash_getchar(slash);
+	else if (ret == 0)
+		ret = -ETIMEDOUT;
 
 	return ret;
 }
 #endif
 
-int slash_set_wait_interruptible(struct slash *slash, slash_waitfunc_t waitfunc)
+/* Standard I/O backend */
+static int slash_stdio_read(struct slash *slash, void *buf, size_t count)
 {
-	slash->waitfunc = waitfunc;
-	return 0;
+	ssize_t ret;
+	int c;
+
+	/* A read from a terminal in raw mode returns all the input that is
+	 * available, which stdio has no way to tell, so read the descriptor
+	 * directly. Otherwise input is returned a character at a time. */
+	if (slash->stdio_raw) {
+		do {
+			ret = read(fileno(slash->file_read), buf, count);
+		} while (ret < 0 && errno == EINTR);
+
+		return ret > 0 ? (int)ret : -EIO;
+	}
+
+	c = getc(slash->file_read);
+	if (c == EOF)
+		return -EIO;
+	*(unsigned char *)buf = c;
+
+	return 1;
 }
 
-int slash_wait_interruptible(struct slash *slash, unsigned int ms)
+static int slash_stdio_write(struct slash *slash, const void *buf, size_t count)
 {
-	if (slash->waitfunc)
-		return slash->waitfunc(slash, ms);
-
-	return -ENOSYS;
+	return fwrite(buf, 1, count, slash->file_write) == count ? (int)count : -EIO;
 }
 
-int slash_printf(struct slash *slash, const char *format, ...)
+static int slash_stdio_flush(struct slash *slash)
 {
-	int ret;
-	va_list args;
+	return fflush(slash->file_write) == 0 ? 0 : -EIO;
+}
 
-	va_start(args, format);
+#ifdef SLASH_HAVE_SELECT
+static int slash_stdio_wait(struct slash *slash, unsigned int ms)
+{
+	return slash_select_wait(slash, fileno(slash->file_read), ms);
+}
+#endif
 
-	ret = vfprintf(slash->file_write, format, args);
+#ifdef SLASH_HAVE_TERMIOS_H
+static int slash_stdio_rawmode(struct slash *slash, bool enable)
+{
+	int fd = fileno(slash->file_read), ret;
 
-	va_end(args);
+	ret = slash_termios_rawmode(slash, fd, enable);
+	slash->stdio_raw = enable && ret == 0 && isatty(fd);
 
 	return ret;
 }
+#endif
 
-static void slash_bell(struct slash *slash)
-{
-	slash_putchar(slash, '\a');
-}
+const struct slash_io slash_io_stdio = {
+	.read = slash_stdio_read,
+	.write = slash_stdio_write,
+	.flush = slash_stdio_flush,
+#ifdef SLASH_HAVE_SELECT
+	.wait = slash_stdio_wait,
+#endif
+#ifdef SLASH_HAVE_TERMIOS_H
+	.rawmode = slash_stdio_rawmode,
+#endif
+};
 
-static bool slash_line_empty(char *line, size_t linelen)
+/* File descriptor backend */
+static int slash_fd_read(struct slash *slash, void *buf, size_t count)
 {
-	while (*line && linelen--)
-		if (!isspace((unsigned int) *line++))
-			return false;
+	ssize_t ret;
 
-	return true;
+	do {
+		ret = read(slash->fd_read, buf, count);
+	} while (ret < 0 && errno == EINTR);
+
+	return ret > 0 ? (int)ret : -EIO;
 }
 
-static bool slash_line_empty_or_comment(char *line, size_t linelen)
+static int slash_fd_write(struct slash *slash, const void *buf, size_t count)
 {
-	while (*line && linelen--) {
-		if (*line == '#')
-			return true;
-		if (!isspace((unsigned int) *line++))
-			return false;
+	const char *p = buf;
+	size_t left = count;
+	ssize_t ret;
+
+	while (left > 0) {
+		ret = write(slash->fd_write, p, left);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return -EIO;
+		p += ret;
+		left -= ret;
 	}
 
-	return true;
+	return count;
 }
 
-/* Command handling */
-void slash_set_privileged(struct slash *slash, bool privileged)
+#ifdef SLASH_HAVE_SELECT
+static int slash_fd_wait(struct slash *slash, unsigned int ms)
 {
-	slash->privileged = privileged;
+	return slash_select_wait(slash, slash->fd_read, ms);
 }
+#endif
 
-static bool slash_command_is_hidden(const struct slash *slash,
-				    const struct slash_command *cmd)
+#ifdef SLASH_HAVE_TERMIOS_H
+static int slash_fd_rawmode(struct slash *slash, bool enable)
 {
-	while (cmd) {
-		if (cmd->flags & SLASH_FLAG_HIDDEN)
-			return true;
+	return slash_termios_rawmode(slash, slash->fd_read, enable);
+}
+#endif
 
-		if (!slash->privileged && (cmd->flags & SLASH_FLAG_PRIVILEGED))
-			return true;
+const struct slash_io slash_io_fd = {
+	.read = slash_fd_read,
+	.write = slash_fd_write,
+#ifdef SLASH_HAVE_SELECT
+	.wait = slash_fd_wait,
+#endif
+#ifdef SLASH_HAVE_TERMIOS_H
+	.rawmode = slash_fd_rawmode,
+#endif
+};
 
-		/* Check that parent command is also not hidden */
-		cmd = cmd->parent;
-	}
+/* Transmit ring backend */
+int slash_ring_init(struct slash_ring *ring, char *buffer, size_t size,
+		    int policy, const struct slash_io *input)
+{
+	/* Positions run freely and are masked, so the size is a power of 2 */
+	if (!buffer || !size || (size & (size - 1)))
+		return -EINVAL;
+	if (policy != SLASH_RING_BLOCK && policy != SLASH_RING_DROP &&
+	    policy != SLASH_RING_YIELD)
+		return -EINVAL;
 
-	return false;
+	memset(ring, 0, sizeof(*ring));
+	ring->buffer = buffer;
+	ring->size = size;
+	ring->policy = policy;
+	ring->input = input;
+
+	return 0;
 }
 
-static char *slash_command_line_token(char *line, size_t *len, char **next)
+size_t slash_ring_peek(struct slash_ring *ring, const char **data)
 {
-	char *token;
+	size_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	size_t offset = ring->tail & (ring->size - 1);
+	size_t count = head - ring->tail;
 
-	/* Skip leading whitespace */
-	while (*line && *line == ' ')
-		line++;
+	/* Only the bytes up to the end of the buffer are contiguous */
+	if (count > ring->size - offset)
+		count = ring->size - offset;
 
-	token = line;
-	*len = 0;
+	*data = &ring->buffer[offset];
 
-	while (*line && *line != ' ') {
-		(*len)++;
-		line++;
-	}
+	return count;
+}
+
+void slash_ring_consume(struct slash_ring *ring, size_t count)
+{
+	__atomic_store_n(&ring->tail, ring->tail + count, __ATOMIC_RELEASE);
+}
 
-	/* Skip trailing whitespace */
-	while (*line && *line == ' ')
-		line++;
+static int slash_ring_read(struct slash *slash, void *buf, size_t count)
+{
+	struct slash_ring *ring = slash->io_arg;
 
-	*next = line;
+	if (!ring->input || !ring->input->read)
+		return -EIO;
 
-	return *len ? token : NULL;
+	return ring->input->read(slash, buf, count);
 }
 
-static struct slash_command *
-slash_command_find(struct slash *slash, char *line, size_t linelen, char **args)
+static int slash_ring_write(struct slash *slash, const void *buf, size_t count)
 {
-	struct slash_command *cur, *command = NULL;
-	char *next = line, *token;
-	size_t tokenlen;
-	bool found;
+	struct slash_ring *ring = slash->io_arg;
+	const char *p = buf;
+	size_t left = count, head, offset, n;
+
+	while (left > 0) {
+		head = ring->head;
+		n = ring->size - (head - __atomic_load_n(&ring->tail,
+							 __ATOMIC_ACQUIRE));
+		if (!n) {
+			if (ring->policy == SLASH_RING_DROP) {
+				ring->dropped += left;
+				break;
+			}
+			if (ring->policy == SLASH_RING_YIELD && ring->yield)
+				ring->yield(ring);
+			continue;
+		}
 
-	while ((token = slash_command_line_token(next, &tokenlen, &next))) {
-		if (token >= line + linelen)
-			break;
+		offset = head & (ring->size - 1);
+		if (n > ring->size - offset)
+			n = ring->size - offset;
+		if (n > left)
+			n = left;
 
-		found = false;
+		memcpy(&ring->buffer[offset], p, n);
+		__atomic_store_n(&ring->head, head + n, __ATOMIC_RELEASE);
+		p += n;
+		left -= n;
 
-		slash_command_list_for_each(cur) {
-			/* Skip if parent does not match */
-			if (cur->parent != command)
-				continue;
+		/* Let the driver transmit while the rest is copied */
+		if (ring->start)
+			ring->start(ring);
+	}
 
-			/* Skip if name does not match */
-			if (strncmp(token, cur->name, tokenlen) != 0)
-				continue;
+	return count;
+}
+
+static int slash_ring_wait(struct slash *slash, unsigned int ms)
+{
+	struct slash_ring *ring = slash->io_arg;
+
+	if (!ring->input || !ring->input->wait)
+		return -ENOSYS;
+
+	return ring->input->wait(slash, ms);
+}
+
+static int slash_ring_rawmode(struct slash *slash, bool enable)
+{
+	struct slash_ring *ring = slash->io_arg;
+
+	if (!ring->input || !ring->input->rawmode)
+		return 0;
+
+	return ring->input->rawmode(slash, enable);
+}
+
+const struct slash_io slash_io_ring = {
+	.read = slash_ring_read,
+	.write = slash_ring_write,
+	.wait = slash_ring_wait,
+	.rawmode = slash_ring_rawmode,
+};
+
+void slash_set_io(struct slash *slash, const struct slash_io *io, void *arg)
+{
+	slash->io = io;
+	slash->io_arg = arg;
+	slash->input_pos = 0;
+	slash->input_len = 0;
+}
+
+static void slash_mark_changed(struct slash *slash, size_t start, size_t end)
+{
+	if (slash->change_start == slash->change_end) {
+		slash->change_start = start;
+		slash->change_end = end;
+	} else {
+		if (start < slash->change_start)
+			slash->change_start = start;
+		if (end > slash->change_end)
+			slash->change_end = end;
+	}
+}
+
+static void slash_mark_inserted(struct slash *slash, size_t pos, size_t n)
+{
+	/* Start a shift if the screen is otherwise up to date, or grow the
+	 * one pending when inserting in its gap */
+	if (slash->change_start == slash->change_end && !slash->shift) {
+		slash->shift_pos = pos;
+		slash->shift = n;
+		slash_mark_changed(slash, pos, pos + n);
+		return;
+	}
+
+	if (slash->shift > 0 &&
+	    slash->change_start == slash->shift_pos &&
+	    slash->change_end == slash->shift_pos + slash->shift &&
+	    pos >= slash->change_start && pos <= slash->change_end) {
+		slash->shift += n;
+		slash->change_end += n;
+		return;
+	}
+
+	slash_mark_changed(slash, pos, slash->length);
+}
+
+static void slash_mark_deleted(struct slash *slash, size_t pos, size_t n)
+{
+	if (!n)
+		return;
+
+	/* Start a shift if the screen is otherwise up to date, or grow the
+	 * one pending for repeated deletes and backspaces */
+	if (slash->change_start == slash->change_end) {
+		if (!slash->shift) {
+			slash->shift_pos = pos;
+			slash->shift = -(int)n;
+			return;
+		}
+		if (slash->shift < 0 && (pos == slash->shift_pos ||
+					 pos + n == slash->shift_pos)) {
+			slash->shift_pos = pos;
+			slash->shift -= n;
+			return;
+		}
+	}
+
+	slash_mark_changed(slash, pos, slash->length);
+}
+
+int slash_set_wait_interruptible(struct slash *slash, slash_waitfunc_t waitfunc)
+{
+	slash->waitfunc = waitfunc;
+	return 0;
+}
+
+int slash_wait_interruptible(struct slash *slash, unsigned int ms)
+{
+	/* Input that has already been read counts as a keypress */
+	if (slash->input_pos < slash->input_len)
+		return (unsigned char)slash->input[slash->input_pos++];
+
+	if (slash->waitfunc)
+		return slash->waitfunc(slash, ms);
+	if (slash->io->wait)
+		return slash->io->wait(slash, ms);
+
+	return -ENOSYS;
+}
+
+/* Formatted output */
+#define SLASH_FMT_LEFT		(1 << 0)
+#define SLASH_FMT_PLUS		(1 << 1)
+#define SLASH_FMT_SPACE		(1 << 2)
+#define SLASH_FMT_ALT		(1 << 3)
+#define SLASH_FMT_ZERO		(1 << 4)
+#define SLASH_FMT_UPPER		(1 << 5)
+
+struct slash_format {
+	struct slash *slash;
+	char *buf;
+	size_t size;
+	size_t len;
+	int count;
+};
+
+static void slash_format_put(struct slash_format *f, const char *s, size_t n)
+{
+	size_t chunk;
+
+	f->count += n;
+
+	while (n > 0) {
+		/* Write full buffers to the context, or truncate */
+		if (f->len == f->size) {
+			if (!f->slash)
+				return;
+			slash_write(f->slash, f->buf, f->len);
+			f->len = 0;
+		}
+
+		chunk = f->size - f->len;
+		if (chunk > n)
+			chunk = n;
+		memcpy(&f->buf[f->len], s, chunk);
+		f->len += chunk;
+		s += chunk;
+		n -= chunk;
+	}
+}
+
+static void slash_format_pad(struct slash_format *f, char c, int n)
+{
+	static const char spaces[] = "                ";
+	static const char zeros[] = "0000000000000000";
+	const char *fill = c == '0' ? zeros : spaces;
+	int chunk;
+
+	while (n > 0) {
+		chunk = n < (int)sizeof(spaces) - 1 ? n : (int)sizeof(spaces) - 1;
+		slash_format_put(f, fill, chunk);
+		n -= chunk;
+	}
+}
+
+static void slash_format_field(struct slash_format *f, const char *prefix,
+			       const char *s, size_t len, int zeros,
+			       int flags, int width)
+{
+	size_t plen = strlen(prefix);
+	int pad = width - (int)(plen + zeros + len);
+
+	/* Zero padding goes between the sign or prefix and the digits */
+	if ((flags & (SLASH_FMT_ZERO | SLASH_FMT_LEFT)) == SLASH_FMT_ZERO &&
+	    pad > 0) {
+		zeros += pad;
+		pad = 0;
+	}
+
+	if (!(flags & SLASH_FMT_LEFT))
+		slash_format_pad(f, ' ', pad);
+	slash_format_put(f, prefix, plen);
+	slash_format_pad(f, '0', zeros);
+	slash_format_put(f, s, len);
+	if (flags & SLASH_FMT_LEFT)
+		slash_format_pad(f, ' ', pad);
+}
+
+static void slash_format_int(struct slash_format *f, uintmax_t value,
+			     bool negative, unsigned int base, int flags,
+			     int width, int precision)
+{
+	const char *digits = flags & SLASH_FMT_UPPER ?
+		"0123456789ABCDEF" : "0123456789abcdef";
+	char buf[24], *p = &buf[sizeof(buf)];
+	const char *prefix = "";
+	size_t len;
+	int zeros = 0;
+
+	/* Decimal is most common, and a constant divisor avoids division */
+	if (base == 10) {
+		do {
+			*--p = '0' + value % 10;
+			value /= 10;
+		} while (value);
+	} else {
+		do {
+			*--p = digits[value & (base - 1)];
+			value >>= base == 16 ? 4 : 3;
+		} while (value);
+	}
+	len = &buf[sizeof(buf)] - p;
+
+	/* A precision gives the minimum number of digits */
+	if (precision >= 0) {
+		flags &= ~SLASH_FMT_ZERO;
+		if ((int)len < precision)
+			zeros = precision - len;
+		else if (precision == 0 && len == 1 && *p == '0')
+			len = 0;
+	}
+
+	if (negative)
+		prefix = "-";
+	else if (flags & SLASH_FMT_PLUS)
+		prefix = "+";
+	else if (flags & SLASH_FMT_SPACE)
+		prefix = " ";
+	else if ((flags & SLASH_FMT_ALT) && base == 16 && *p != '0')
+		prefix = flags & SLASH_FMT_UPPER ? "0X" : "0x";
+	else if ((flags & SLASH_FMT_ALT) && base == 8 && !zeros)
+		prefix = "0";
+
+	slash_format_field(f, prefix, p, len, zeros, flags, width);
+}
+
+/* Exact decimal digits of a double, with the integer part in base 1e9
+ * groups and the fraction as a fixed point number in 32 bit limbs */
+struct slash_digits {
+	uint32_t group[35];
+	int ngroups;
+	int nint;
+	uint32_t limb[35];
+	int nlimbs;
+	int pos;
+};
+
+static const uint32_t slash_pow10[9] = {
+	1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000,
+};
+
+static void slash_digits_place(uint32_t *limb, int n, uint64_t v, int bit)
+{
+	int word = bit / 32, shift = bit % 32;
+	uint64_t lo = (uint64_t)(uint32_t)v << shift;
+	uint64_t hi = ((v >> 32) << shift) | (lo >> 32);
+
+	/* The value has at most 53 bits, so it spans at most three limbs */
+	limb[word] |= (uint32_t)lo;
+	if (word + 1 < n)
+		limb[word + 1] |= (uint32_t)hi;
+	if (word + 2 < n)
+		limb[word + 2] |= (uint32_t)(hi >> 32);
+}
+
+static void slash_digits_init(struct slash_digits *d, double value)
+{
+	uint64_t bits, mantissa, integer;
+	uint32_t top;
+	int exponent, n, i;
+
+	memcpy(&bits, &value, sizeof(bits));
+	mantissa = bits & ((1ULL << 52) - 1);
+	exponent = (bits >> 52) & 0x7ff;
+	if (exponent)
+		mantissa |= 1ULL << 52;
+	else
+		exponent = 1;
+	exponent -= 1075;
+
+	memset(d, 0, sizeof(*d));
+
+	if (exponent >= 0) {
+		/* Integer of up to 1024 bits, divided into groups of 9 digits */
+		n = (53 + exponent + 31) / 32;
+		slash_digits_place(d->limb, n, mantissa, exponent);
+		while (n > 0) {
+			uint64_t rem = 0;
+
+			for (i = n - 1; i >= 0; i--) {
+				rem = (rem << 32) | d->limb[i];
+				d->limb[i] = rem / 1000000000;
+				rem %= 1000000000;
+			}
+			d->group[d->ngroups++] = rem;
+			while (n > 0 && !d->limb[n - 1])
+				n--;
+		}
+	} else {
+		/* Integer of at most 53 bits and a fraction of -exponent bits,
+		 * aligned to the top of the limbs */
+		integer = -exponent < 64 ? mantissa >> -exponent : 0;
+		if (-exponent < 64)
+			mantissa &= (1ULL << -exponent) - 1;
+		while (integer) {
+			d->group[d->ngroups++] = integer % 1000000000;
+			integer /= 1000000000;
+		}
+		d->nlimbs = (-exponent + 31) / 32;
+		slash_digits_place(d->limb, d->nlimbs, mantissa,
+				   32 * d->nlimbs + exponent);
+	}
+
+	if (d->ngroups) {
+		top = d->group[d->ngroups - 1];
+		for (i = 1; i < 9 && top >= slash_pow10[i]; i++);
+		d->nint = 9 * (d->ngroups - 1) + i;
+	}
+}
+
+static int slash_digits_next(struct slash_digits *d)
+{
+	uint64_t cur;
+	uint32_t carry = 0;
+	int r, i;
+
+	/* Integer digits from the groups, then fraction digits */
+	if (d->pos < d->nint) {
+		r = d->nint - 1 - d->pos++;
+		return d->group[r / 9] / slash_pow10[r % 9] % 10;
+	}
+
+	d->pos++;
+	for (i = 0; i < d->nlimbs; i++) {
+		cur = (uint64_t)d->limb[i] * 10 + carry;
+		d->limb[i] = cur;
+		carry = cur >> 32;
+	}
+
+	return carry;
+}
+
+static bool slash_digits_zero(struct slash_digits *d)
+{
+	int r = d->nint - d->pos, i;
+
+	/* Remaining integer digits */
+	if (r > 0) {
+		if (r % 9 && d->group[r / 9] % slash_pow10[r % 9])
+			return false;
+		for (i = 0; i < r / 9; i++)
+			if (d->group[i])
+				return false;
+	}
+
+	for (i = 0; i < d->nlimbs; i++)
+		if (d->limb[i])
+			return false;
+
+	return true;
+}
+
+struct slash_round {
+	int last_non9;
+	int last_nonzero;
+	bool up;
+};
+
+static void slash_digits_round(struct slash_digits *d, int start, int cut,
+			       struct slash_round *r)
+{
+	int i, c = 0, next;
+
+	/* Keep digits start to cut, and note where a carry would stop */
+	r->last_non9 = -1;
+	r->last_nonzero = -1;
+	for (i = 0; i < cut; i++) {
+		c = slash_digits_next(d);
+		if (i < start)
+			continue;
+		if (c != 9)
+			r->last_non9 = i;
+		if (c)
+			r->last_nonzero = i;
+	}
+
+	/* Round half to even, like the C library */
+	next = slash_digits_next(d);
+	r->up = next > 5 ||
+		(next == 5 && (!slash_digits_zero(d) ||
+			       (cut > start && (c & 1))));
+}
+
+static int slash_digits_rounded(struct slash_digits *d,
+				struct slash_round *r, int i)
+{
+	int c = slash_digits_next(d);
+
+	if (!r->up || i < r->last_non9)
+		return c;
+
+	return i == r->last_non9 ? c + 1 : 0;
+}
+
+/* Index of the last significant digit after rounding, or -1 */
+static int slash_digits_last(struct slash_round *r)
+{
+	return r->up ? r->last_non9 : r->last_nonzero;
+}
+
+static int slash_format_begin(struct slash_format *f, const char *prefix,
+			      int len, int flags, int width)
+{
+	int pad = width - len - (int)strlen(prefix);
+
+	if (!(flags & (SLASH_FMT_LEFT | SLASH_FMT_ZERO)))
+		slash_format_pad(f, ' ', pad);
+	slash_format_put(f, prefix, strlen(prefix));
+	if ((flags & (SLASH_FMT_LEFT | SLASH_FMT_ZERO)) == SLASH_FMT_ZERO)
+		slash_format_pad(f, '0', pad);
+
+	return flags & SLASH_FMT_LEFT ? pad : 0;
+}
+
+static void slash_format_digit(struct slash_format *f, int c)
+{
+	char digit = '0' + c;
+
+	slash_format_put(f, &digit, 1);
+}
+
+static void slash_format_fixed(struct slash_format *f, double value,
+			       const char *prefix, int flags, int width,
+			       int precision, bool strip)
+{
+	struct slash_digits d;
+	struct slash_round r;
+	int nint, last, shown, len, pad, i;
+	bool carry;
+
+	slash_digits_init(&d, value);
+	nint = d.nint;
+	slash_digits_round(&d, 0, nint + precision, &r);
+	carry = r.up && r.last_non9 < 0;
+
+	/* Fraction digits, without trailing zeros for %g */
+	shown = precision;
+	if (strip) {
+		last = carry ? -1 : slash_digits_last(&r);
+		shown = last >= nint ? last - nint + 1 : 0;
+	}
+
+	len = (nint ? nint : 1) + (carry && nint) +
+		(shown || (flags & SLASH_FMT_ALT) ? 1 + shown : 0);
+	pad = slash_format_begin(f, prefix, len, flags, width);
+
+	slash_digits_init(&d, value);
+	if (carry || !nint)
+		slash_format_digit(f, carry);
+	for (i = 0; i < nint; i++)
+		slash_format_digit(f, slash_digits_rounded(&d, &r, i));
+	if (shown || (flags & SLASH_FMT_ALT))
+		slash_format_put(f, ".", 1);
+	for (i = nint; i < nint + shown; i++)
+		slash_format_digit(f, slash_digits_rounded(&d, &r, i));
+
+	slash_format_pad(f, ' ', pad);
+}
+
+static int slash_format_exp_round(struct slash_digits *d, double value,
+				  int precision, struct slash_round *r,
+				  int *start)
+{
+	int exponent = 0;
+
+	/* The exponent is given by the first nonzero digit */
+	slash_digits_init(d, value);
+	*start = 0;
+	if (value != 0) {
+		while (!slash_digits_next(d))
+			(*start)++;
+		exponent = d->nint - 1 - *start;
+	}
+
+	slash_digits_init(d, value);
+	slash_digits_round(d, *start, *start + precision + 1, r);
+	if (r->up && r->last_non9 < 0)
+		exponent++;
+
+	return exponent;
+}
+
+static void slash_format_exp(struct slash_format *f, double value,
+			     const char *prefix, int flags, int width,
+			     int precision, bool strip)
+{
+	struct slash_digits d;
+	struct slash_round r;
+	int exponent, start, last, shown, len, pad, i;
+	char exp[8], *p = &exp[sizeof(exp)];
+	bool carry;
+
+	exponent = slash_format_exp_round(&d, value, precision, &r, &start);
+	carry = r.up && r.last_non9 < 0;
+
+	shown = precision;
+	if (strip) {
+		last = carry ? -1 : slash_digits_last(&r);
+		shown = last > start ? last - start : 0;
+	}
+
+	/* Exponent with at least two digits */
+	i = exponent < 0 ? -exponent : exponent;
+	do {
+		*--p = '0' + i % 10;
+		i /= 10;
+	} while (i || p > &exp[sizeof(exp)] - 2);
+	*--p = exponent < 0 ? '-' : '+';
+	*--p = flags & SLASH_FMT_UPPER ? 'E' : 'e';
+
+	len = 1 + (shown || (flags & SLASH_FMT_ALT) ? 1 + shown : 0) +
+		(&exp[sizeof(exp)] - p);
+	pad = slash_format_begin(f, prefix, len, flags, width);
+
+	slash_digits_init(&d, value);
+	for (i = 0; i < start; i++)
+		slash_digits_next(&d);
+	if (carry) {
+		slash_format_digit(f, 1);
+		slash_digits_rounded(&d, &r, start);
+	} else {
+		slash_format_digit(f, slash_digits_rounded(&d, &r, start));
+	}
+	if (shown || (flags & SLASH_FMT_ALT))
+		slash_format_put(f, ".", 1);
+	for (i = start + 1; i <= start + shown; i++)
+		slash_format_digit(f, slash_digits_rounded(&d, &r, i));
+	slash_format_put(f, p, &exp[sizeof(exp)] - p);
+
+	slash_format_pad(f, ' ', pad);
+}
+
+static void slash_format_float(struct slash_format *f, double value, char conv,
+			       int flags, int width, int precision)
+{
+	struct slash_digits d;
+	struct slash_round r;
+	const char *prefix = "";
+	bool upper = flags & SLASH_FMT_UPPER;
+	int exponent, start;
+	uint64_t bits;
+
+	memcpy(&bits, &value, sizeof(bits));
+	if (bits >> 63) {
+		prefix = "-";
+		value = -value;
+	} else if (flags & SLASH_FMT_PLUS) {
+		prefix = "+";
+	} else if (flags & SLASH_FMT_SPACE) {
+		prefix = " ";
+	}
+
+	if (value != value || (value != 0 && value == value * 2)) {
+		flags &= ~SLASH_FMT_ZERO;
+		slash_format_field(f, prefix, value != value ?
+				   (upper ? "NAN" : "nan") :
+				   (upper ? "INF" : "inf"), 3, 0, flags, width);
+		return;
+	}
+
+	if (precision < 0)
+		precision = 6;
+
+	if (conv == 'f') {
+		slash_format_fixed(f, value, prefix, flags, width, precision,
+				   false);
+	} else if (conv == 'e') {
+		slash_format_exp(f, value, prefix, flags, width, precision,
+				 false);
+	} else {
+		/* %g uses the exponent of the value rounded as for %e */
+		if (precision == 0)
+			precision = 1;
+		exponent = slash_format_exp_round(&d, value, precision - 1,
+						  &r, &start);
+		if (exponent >= -4 && exponent < precision)
+			slash_format_fixed(f, value, prefix, flags, width,
+					   precision - 1 - exponent,
+					   !(flags & SLASH_FMT_ALT));
+		else
+			slash_format_exp(f, value, prefix, flags, width,
+					 precision - 1,
+					 !(flags & SLASH_FMT_ALT));
+	}
+}
+
+static int slash_format(struct slash_format *f, const char *format,
+			va_list args)
+{
+	const char *p = format, *start, *s;
+	int flags, width, precision, length;
+	uintmax_t value;
+	intmax_t svalue;
+	double dvalue;
+	size_t len;
+	char c;
+
+	while (*p) {
+		/* Literal text up to the next conversion */
+		start = p;
+		while (*p && *p != '%')
+			p++;
+		slash_format_put(f, start, p - start);
+		if (!*p)
+			break;
+		start = p++;
+
+		/* Flags */
+		flags = 0;
+		for (;; p++) {
+			if (*p == '-')
+				flags |= SLASH_FMT_LEFT;
+			else if (*p == '+')
+				flags |= SLASH_FMT_PLUS;
+			else if (*p == ' ')
+				flags |= SLASH_FMT_SPACE;
+			else if (*p == '#')
+				flags |= SLASH_FMT_ALT;
+			else if (*p == '0')
+				flags |= SLASH_FMT_ZERO;
+			else
+				break;
+		}
+
+		/* Field width */
+		width = 0;
+		if (*p == '*') {
+			width = va_arg(args, int);
+			if (width < 0) {
+				flags |= SLASH_FMT_LEFT;
+				width = -width;
+			}
+			p++;
+		} else {
+			while (*p >= '0' && *p <= '9')
+				width = width * 10 + *p++ - '0';
+		}
+
+		/* Precision */
+		precision = -1;
+		if (*p == '.') {
+			p++;
+			precision = 0;
+			if (*p == '*') {
+				precision = va_arg(args, int);
+				if (precision < 0)
+					precision = -1;
+				p++;
+			} else {
+				while (*p >= '0' && *p <= '9')
+					precision = precision * 10 + *p++ - '0';
+			}
+		}
+
+		/* Length modifier, negative for 'h', positive for wider types */
+		length = 0;
+		if (*p == 'h') {
+			length = *++p == 'h' ? -2 : -1;
+			if (length == -2)
+				p++;
+		} else if (*p == 'l') {
+			length = *++p == 'l' ? 2 : 1;
+			if (length == 2)
+				p++;
+		} else if (*p == 'z') {
+			length = 4;
+			p++;
+		} else if (*p == 't') {
+			length = 5;
+			p++;
+		} else if (*p == 'j') {
+			length = 3;
+			p++;
+		} else if (*p == 'L') {
+			length = 6;
+			p++;
+		}
+
+		switch (c = *p++) {
+		case 'd':
+		case 'i':
+			if (length == 4 || length == 5)
+				svalue = va_arg(args, ptrdiff_t);
+			else if (length == 3)
+				svalue = va_arg(args, intmax_t);
+			else if (length == 2)
+				svalue = va_arg(args, long long);
+			else if (length == 1)
+				svalue = va_arg(args, long);
+			else
+				svalue = va_arg(args, int);
+			if (length == -1)
+				svalue = (short)svalue;
+			else if (length == -2)
+				svalue = (signed char)svalue;
+			value = svalue < 0 ? -(uintmax_t)svalue : (uintmax_t)svalue;
+			slash_format_int(f, value, svalue < 0, 10, flags,
+					 width, precision);
+			break;
+		case 'u':
+		case 'x':
+		case 'X':
+		case 'o':
+			if (length == 5)
+				value = va_arg(args, ptrdiff_t);
+			else if (length == 4)
+				value = va_arg(args, size_t);
+			else if (length == 3)
+				value = va_arg(args, uintmax_t);
+			else if (length == 2)
+				value = va_arg(args, unsigned long long);
+			else if (length == 1)
+				value = va_arg(args, unsigned long);
+			else
+				value = va_arg(args, unsigned int);
+			if (length == -1)
+				value = (unsigned short)value;
+			else if (length == -2)
+				value = (unsigned char)value;
+			if (c == 'X')
+				flags |= SLASH_FMT_UPPER;
+			flags &= ~(SLASH_FMT_PLUS | SLASH_FMT_SPACE);
+			slash_format_int(f, value, false,
+					 c == 'o' ? 8 : c == 'u' ? 10 : 16,
+					 flags, width, precision);
+			break;
+		case 'p':
+			value = (uintptr_t)va_arg(args, void *);
+			flags = (flags & SLASH_FMT_LEFT) | SLASH_FMT_ALT;
+			slash_format_int(f, value, false, 16, flags, width, -1);
+			break;
+		case 'c':
+			c = va_arg(args, int);
+			slash_format_field(f, "", &c, 1, 0,
+					   flags & SLASH_FMT_LEFT, width);
+			break;
+		case 's':
+			s = va_arg(args, const char *);
+			if (!s)
+				s = "(null)";
+			/* The string need not be terminated within precision */
+			for (len = 0; (precision < 0 || len < (size_t)precision) &&
+				     s[len]; len++);
+			slash_format_field(f, "", s, len, 0,
+					   flags & SLASH_FMT_LEFT, width);
+			break;
+		case 'e':
+		case 'E':
+		case 'f':
+		case 'F':
+		case 'g':
+		case 'G':
+			if (c == 'E' || c == 'F' || c == 'G')
+				flags |= SLASH_FMT_UPPER;
+			if (length == 6)
+				dvalue = va_arg(args, long double);
+			else
+				dvalue = va_arg(args, double);
+			slash_format_float(f, dvalue, c | 0x20, flags,
+					   width, precision);
+			break;
+		case '%':
+			slash_format_put(f, "%", 1);
+			break;
+		default:
+			/* Unsupported conversion, output as is */
+			if (!c)
+				p--;
+			slash_format_put(f, start, p - start);
+			break;
+		}
+	}
+
+	return f->count;
+}
+
+int slash_snprintf(char *buf, size_t size, const char *format, ...)
+{
+	struct slash_format f = {
+		.buf = buf,
+		.size = size ? size - 1 : 0,
+	};
+	va_list args;
+	int ret;
+
+	va_start(args, format);
+	ret = slash_format(&f, format, args);
+	va_end(args);
+
+	if (size)
+		buf[f.len] = '\0';
+
+	return ret;
+}
+
+int slash_vprintf(struct slash *slash, const char *format, va_list args)
+{
+	char buf[SLASH_PRINTF_SIZE];
+	struct slash_format f = {
+		.slash = slash,
+		.buf = buf,
+		.size = sizeof(buf),
+	};
+	int ret;
+
+#ifndef SLASH_BUILTIN_PRINTF
+	if (slash->io == &slash_io_stdio) {
+		ret = vfprintf(slash->file_write, format, args);
+		if (ret > 0) {
+			slash->stats.writes++;
+			slash->stats.bytes += ret;
+		}
+		return ret;
+	}
+#endif
+
+	/* Output is written in buffer sized pieces */
+	ret = slash_format(&f, format, args);
+	if (f.len)
+		slash_write(slash, buf, f.len);
+
+	return ret;
+}
+
+int slash_printf(struct slash *slash, const char *format, ...)
+{
+	va_list args;
+	int ret;
+
+	va_start(args, format);
+	ret = slash_vprintf(slash, format, args);
+	va_end(args);
+
+	return ret;
+}
+
+static void slash_bell(struct slash *slash)
+{
+	slash_putchar(slash, '\a');
+}
+
+/* Line scanning */
+#if defined(SLASH_SCAN_AVX2)
+typedef __m256i slash_vec_t;
+#define SLASH_VEC_SIZE		32
+#define SLASH_VEC_MASK		0xffffffffU
+#define slash_vec_load(p)	_mm256_loadu_si256((const __m256i *)(p))
+#define slash_vec_set(c)	_mm256_set1_epi8(c)
+#define slash_vec_eq(a, b)	((uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b)))
+#elif defined(SLASH_SCAN_SSE2)
+typedef __m128i slash_vec_t;
+#define SLASH_VEC_SIZE		16
+#define SLASH_VEC_MASK		0xffffU
+#define slash_vec_load(p)	_mm_loadu_si128((const __m128i *)(p))
+#define slash_vec_set(c)	_mm_set1_epi8(c)
+#define slash_vec_eq(a, b)	((uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)))
+#else
+/* Without vector instructions, check a word at a time */
+#define SLASH_WORD_ONES		(~0UL / 0xff)
+#define slash_word_set(c)	(SLASH_WORD_ONES * (unsigned char)(c))
+#define slash_word_has_zero(w)	(((w) - SLASH_WORD_ONES) & ~(w) & (SLASH_WORD_ONES << 7))
+#endif
+
+/* Return first byte in [p, end) that is a or b, or end */
+static const char *slash_scan_until(const char *p, const char *end, char a, char b)
+{
+#ifdef SLASH_VEC_SIZE
+	const slash_vec_t va = slash_vec_set(a), vb = slash_vec_set(b);
+	slash_vec_t v;
+	uint32_t mask;
+
+	for (; end - p >= SLASH_VEC_SIZE; p += SLASH_VEC_SIZE) {
+		v = slash_vec_load(p);
+		mask = slash_vec_eq(v, va) | slash_vec_eq(v, vb);
+		if (mask)
+			return p + __builtin_ctz(mask);
+	}
+#else
+	const unsigned long wa = slash_word_set(a), wb = slash_word_set(b);
+	unsigned long w;
+
+	/* Find the word, and the byte below */
+	for (; end - p >= (ptrdiff_t)sizeof(w); p += sizeof(w)) {
+		memcpy(&w, p, sizeof(w));
+		if (slash_word_has_zero(w ^ wa) || slash_word_has_zero(w ^ wb))
+			break;
+	}
+#endif
+
+	while (p < end && *p != a && *p != b)
+		p++;
+
+	return p;
+}
+
+/* Return first byte in [p, end) that ends an unquoted argument, or end */
+static const char *slash_scan_token(const char *p, const char *end)
+{
+#ifdef SLASH_VEC_SIZE
+	const slash_vec_t vspace = slash_vec_set(' '), vnul = slash_vec_set('\0');
+	const slash_vec_t vsemi = slash_vec_set(';'), vamp = slash_vec_set('&');
+	const slash_vec_t vbar = slash_vec_set('|');
+	slash_vec_t v;
+	uint32_t mask;
+
+	for (; end - p >= SLASH_VEC_SIZE; p += SLASH_VEC_SIZE) {
+		v = slash_vec_load(p);
+		mask = slash_vec_eq(v, vspace) | slash_vec_eq(v, vnul) |
+		       slash_vec_eq(v, vsemi) | slash_vec_eq(v, vamp) |
+		       slash_vec_eq(v, vbar);
+		if (mask)
+			return p + __builtin_ctz(mask);
+	}
+#else
+	const unsigned long wspace = slash_word_set(' '), wsemi = slash_word_set(';');
+	const unsigned long wamp = slash_word_set('&'), wbar = slash_word_set('|');
+	unsigned long w;
+
+	for (; end - p >= (ptrdiff_t)sizeof(w); p += sizeof(w)) {
+		memcpy(&w, p, sizeof(w));
+		if (slash_word_has_zero(w) || slash_word_has_zero(w ^ wspace) ||
+		    slash_word_has_zero(w ^ wsemi) || slash_word_has_zero(w ^ wamp) ||
+		    slash_word_has_zero(w ^ wbar))
+			break;
+	}
+#endif
+
+	while (p < end && *p != ' ' && *p != '\0' &&
+	       *p != ';' && *p != '&' && *p != '|')
+		p++;
+
+	return p;
+}
+
+/* Return first byte in [p, end) that is not c, or end */
+static const char *slash_scan_while(const char *p, const char *end, char c)
+{
+#ifdef SLASH_VEC_SIZE
+	const slash_vec_t vc = slash_vec_set(c);
+	uint32_t mask;
+
+	for (; end - p >= SLASH_VEC_SIZE; p += SLASH_VEC_SIZE) {
+		mask = slash_vec_eq(slash_vec_load(p), vc) ^ SLASH_VEC_MASK;
+		if (mask)
+			return p + __builtin_ctz(mask);
+	}
+#else
+	const unsigned long wc = slash_word_set(c);
+	unsigned long w;
+
+	for (; end - p >= (ptrdiff_t)sizeof(w); p += sizeof(w)) {
+		memcpy(&w, p, sizeof(w));
+		if (w != wc)
+			break;
+	}
+#endif
+
+	while (p < end && *p == c)
+		p++;
+
+	return p;
+}
+
+/* Return last byte in [start, p) that is c, or NULL */
+static const char *slash_scan_back(const char *start, const char *p, char c)
+{
+#ifdef SLASH_VEC_SIZE
+	const slash_vec_t vc = slash_vec_set(c);
+	uint32_t mask;
+
+	for (; p - start >= SLASH_VEC_SIZE; p -= SLASH_VEC_SIZE) {
+		mask = slash_vec_eq(slash_vec_load(p - SLASH_VEC_SIZE), vc);
+		if (mask)
+			return p - 1 - __builtin_clz(mask) +
+				(32 - SLASH_VEC_SIZE);
+	}
+#else
+	const unsigned long wc = slash_word_set(c);
+	unsigned long w;
+
+	for (; p - start >= (ptrdiff_t)sizeof(w); p -= sizeof(w)) {
+		memcpy(&w, p - sizeof(w), sizeof(w));
+		if (slash_word_has_zero(w ^ wc))
+			break;
+	}
+#endif
+
+	while (p > start)
+		if (*--p == c)
+			return p;
+
+	return NULL;
+}
+
+static bool slash_line_empty(const char *line, size_t linelen)
+{
+	const char *end = line + linelen;
+
+	while ((line = slash_scan_while(line, end, ' ')) < end && *line)
+		if (!isspace((unsigned int) *line++))
+			return false;
+
+	return true;
+}
+
+static bool slash_line_empty_or_comment(const char *line, size_t linelen)
+{
+	const char *end = line + linelen;
+
+	while ((line = slash_scan_while(line, end, ' ')) < end && *line) {
+		if (*line == '#')
+			return true;
+		if (!isspace((unsigned int) *line++))
+			return false;
+	}
+
+	return true;
+}
+
+/* Command handling */
+void slash_set_privileged(struct slash *slash, bool privileged)
+{
+	slash->level = privileged ? SLASH_LEVEL_COUNT - 1 : SLASH_LEVEL_OPERATOR;
+}
+
+int slash_set_level(struct slash *slash, unsigned int level)
+{
+	if (level >= SLASH_LEVEL_COUNT)
+		return -EINVAL;
+
+	slash->level = level;
+
+	return 0;
+}
+
+void slash_set_abbreviate(struct slash *slash, bool abbreviate)
+{
+	slash->abbreviate = abbreviate;
+}
+
+/* Command index */
+static unsigned int slash_command_depth(const struct slash_command *cmd)
+{
+	unsigned int depth = 0;
+
+	while (cmd) {
+		depth++;
+		cmd = cmd->parent;
+	}
+
+	return depth;
+}
+
+static int slash_command_path_cmp(const struct slash_command *a,
+				  const struct slash_command *b)
+{
+	int ret;
+
+	/* Both commands must be at the same depth */
+	if (a == b)
+		return 0;
+
+	ret = slash_command_path_cmp(a->parent, b->parent);
+	if (ret)
+		return ret;
+
+	return strcmp(a->name, b->name);
+}
+
+static uint32_t slash_name_prefix(const char *name, size_t len)
+{
+	uint32_t prefix = 0;
+	size_t i;
+
+	for (i = 0; i < 4; i++) {
+		prefix <<= 8;
+		if (i < len)
+			prefix |= (unsigned char)name[i];
+	}
+
+	return prefix;
+}
+
+static int slash_node_cmp(const void *a, const void *b)
+{
+	const struct slash_command *ca = ((const struct slash_node *)a)->command;
+	const struct slash_command *cb = ((const struct slash_node *)b)->command;
+	unsigned int da, db;
+
+	/* Sort by depth first to get breadth-first order */
+	da = slash_command_depth(ca);
+	db = slash_command_depth(cb);
+	if (da != db)
+		return da < db ? -1 : 1;
+
+	return slash_command_path_cmp(ca, cb);
+}
+
+#ifdef SLASH_HAVE_DL_ITERATE_PHDR
+/* Sum of object loads and unloads when the index was built */
+static unsigned long long slash_dl_generation;
+
+struct slash_dl_objects {
+	struct dl_phdr_info *info;
+	size_t count;
+	size_t size;
+	unsigned long long generation;
+};
+
+static int slash_dl_collect(struct dl_phdr_info *info, size_t size, void *data)
+{
+	struct slash_dl_objects *objects = data;
+	struct dl_phdr_info *tmp;
+
+	if (size >= offsetof(struct dl_phdr_info, dlpi_subs) + sizeof(info->dlpi_subs))
+		objects->generation = info->dlpi_adds + info->dlpi_subs;
+
+	if (objects->count == objects->size) {
+		tmp = realloc(objects->info, (objects->size + 8) * sizeof(*tmp));
+		if (!tmp)
+			return -ENOMEM;
+		objects->info = tmp;
+		objects->size += 8;
+	}
+
+	objects->info[objects->count++] = *info;
+
+	return 0;
+}
+
+static int slash_dl_generation_get(struct dl_phdr_info *info, size_t size, void *data)
+{
+	unsigned long long *generation = data;
+
+	if (size >= offsetof(struct dl_phdr_info, dlpi_subs) + sizeof(info->dlpi_subs))
+		*generation = info->dlpi_adds + info->dlpi_subs;
+
+	/* The counters are the same for all objects, so stop here */
+	return 1;
+}
+
+static bool slash_dl_contains(const struct dl_phdr_info *info, const void *addr)
+{
+	const ElfW(Phdr) *phdr;
+	uintptr_t start, ptr = (uintptr_t)addr;
+	int i;
+
+	for (i = 0; i < info->dlpi_phnum; i++) {
+		phdr = &info->dlpi_phdr[i];
+		if (phdr->p_type != PT_LOAD)
+			continue;
+		start = info->dlpi_addr + phdr->p_vaddr;
+		if (ptr >= start && ptr < start + phdr->p_memsz)
+			return true;
+	}
+
+	return false;
+}
+
+/* Find the command tables of all loaded objects */
+static int slash_dl_tables(struct slash_table **tables, size_t *count)
+{
+	struct slash_dl_objects objects = {0};
+	struct slash_command *start, *stop;
+	struct slash_table *tmp;
+	const char *name;
+	void *handle;
+	size_t i, j;
+	int ret;
+
+	ret = dl_iterate_phdr(slash_dl_collect, &objects);
+	if (ret < 0)
+		goto out;
+
+	/* Look up symbols outside dl_iterate_phdr() to avoid loader locks */
+	for (i = 0; i < objects.count; i++) {
+		name = objects.info[i].dlpi_name;
+		handle = dlopen(name && name[0] ? name : NULL, RTLD_LAZY | RTLD_NOLOAD);
+		if (!handle)
+			continue;
+
+		start = dlsym(handle, "__start_slash");
+		stop = dlsym(handle, "__stop_slash");
+		dlclose(handle);
+
+		/* dlsym() also searches dependencies, so check the address */
+		if (!start || !stop || !slash_dl_contains(&objects.info[i], start))
+			continue;
+
+		for (j = 0; j < *count; j++)
+			if ((*tables)[j].start == start)
+				break;
+		if (j < *count)
+			continue;
+
+		tmp = realloc(*tables, (*count + 1) * sizeof(*tmp));
+		if (!tmp) {
+			ret = -ENOMEM;
+			goto out;
+		}
+		*tables = tmp;
+		(*tables)[*count].start = start;
+		(*tables)[*count].stop = stop;
+		(*count)++;
+	}
+
+	slash_dl_generation = objects.generation;
+	ret = 0;
+out:
+	free(objects.info);
+	return ret;
+}
+#endif
+
+/**
+ * struct slash_registry_entry - Command registered at runtime.
+ * @command: Registered command, or NULL for an empty slot.
+ * @children: Number of registered commands with this command as parent.
+ */
+struct slash_registry_entry {
+	struct slash_command *command;
+	unsigned int children;
+};
+
+/* Open addressing hash table of registered commands, keyed by pointer */
+static struct slash_registry_entry *slash_registry;
+static size_t slash_registry_size;
+static size_t slash_registry_count;
+
+/* Command tables included in the current index */
+static struct slash_table *slash_tables;
+static size_t slash_tables_count;
+
+/* Set when the index must be rebuilt before the next lookup */
+static bool slash_index_dirty;
+
+static size_t slash_registry_hash(const struct slash_command *command)
+{
+	uintptr_t key = (uintptr_t)command / sizeof(long);
+
+	return (key * 2654435761u) & (slash_registry_size - 1);
+}
+
+static struct slash_registry_entry *
+slash_registry_find(const struct slash_command *command)
+{
+	size_t i;
+
+	if (!slash_registry_size)
+		return NULL;
+
+	i = slash_registry_hash(command);
+	while (slash_registry[i].command) {
+		if (slash_registry[i].command == command)
+			return &slash_registry[i];
+		i = (i + 1) & (slash_registry_size - 1);
+	}
+
+	return NULL;
+}
+
+static void slash_registry_insert(struct slash_registry_entry *entry)
+{
+	size_t i;
+
+	i = slash_registry_hash(entry->command);
+	while (slash_registry[i].command)
+		i = (i + 1) & (slash_registry_size - 1);
+
+	slash_registry[i] = *entry;
+}
+
+static int slash_registry_grow(void)
+{
+	struct slash_registry_entry *old = slash_registry;
+	size_t i, size = slash_registry_size;
+
+	slash_registry_size = size ? size * 2 : 16;
+	slash_registry = calloc(slash_registry_size, sizeof(*slash_registry));
+	if (!slash_registry) {
+		slash_registry = old;
+		slash_registry_size = size;
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < size; i++)
+		if (old[i].command)
+			slash_registry_insert(&old[i]);
+
+	free(old);
+
+	return 0;
+}
+
+static void slash_registry_remove(struct slash_registry_entry *entry)
+{
+	size_t i, j, home;
+
+	i = entry - slash_registry;
+	slash_registry[i].command = NULL;
+
+	/* Shift back following entries that would no longer be found */
+	j = i;
+	while (1) {
+		j = (j + 1) & (slash_registry_size - 1);
+		if (!slash_registry[j].command)
+			break;
+		home = slash_registry_hash(slash_registry[j].command);
+		if (((j - home) & (slash_registry_size - 1)) >=
+		    ((j - i) & (slash_registry_size - 1))) {
+			slash_registry[i] = slash_registry[j];
+			slash_registry[j].command = NULL;
+			i = j;
+		}
+	}
+}
+
+static bool slash_command_in_tables(const struct slash_command *command)
+{
+	size_t i;
+
+	for (i = 0; i < slash_tables_count; i++)
+		if (command >= slash_tables[i].start && command < slash_tables[i].stop)
+			return true;
+
+	return false;
+}
+
+static int slash_node_init(struct slash_node *node, struct slash_command *cmd)
+{
+	size_t len;
+
+	len = cmd->namelen ? cmd->namelen : strlen(cmd->name);
+	if (len > UINT8_MAX)
+		return -ENAMETOOLONG;
+
+	node->command = cmd;
+	node->namelen = len;
+	node->prefix = slash_name_prefix(cmd->name, len);
+
+	return 0;
+}
+
+/* Compute the nodes shown at each access level */
+static uint32_t *slash_level_build(const struct slash_node *nodes, size_t count)
+{
+	const struct slash_node *node;
+	struct slash_command *cmd;
+	uint32_t *shown, *map;
+	size_t i, words;
+	unsigned int level;
+
+	words = slash_bitmap_words(count);
+	shown = calloc(SLASH_LEVEL_COUNT * words, sizeof(*shown));
+	if (!shown)
+		return NULL;
+
+	/* Parents are visited before their children in breadth-first order */
+	for (level = 0; level < SLASH_LEVEL_COUNT; level++) {
+		map = &shown[level * words];
+		slash_bit_set(map, 0);
+		for (i = 0; i < count; i++) {
+			if (!slash_bit_test(map, i))
+				continue;
+			for (node = &nodes[nodes[i].child];
+			     node < &nodes[nodes[i].child + nodes[i].children];
+			     node++) {
+				cmd = node->command;
+				if (!(cmd->flags & SLASH_FLAG_HIDDEN) &&
+				    slash_command_level(cmd) <= level)
+					slash_bit_set(map, node - nodes);
+			}
+		}
+	}
+
+	return shown;
+}
+
+static int slash_index_build(void)
+{
+	struct slash_command *cmd;
+	struct slash_node *nodes, *node;
+	struct slash_table *tables;
+	uint32_t *shown;
+	size_t count, ntables, i, next;
+	int ret = 0;
+
+	/* The table linked with slash is always included */
+	tables = malloc(sizeof(*tables));
+	if (!tables)
+		return -ENOMEM;
+	tables[0].start = &__start_slash;
+	tables[0].stop = &__stop_slash;
+	ntables = 1;
+
+#ifdef SLASH_HAVE_DL_ITERATE_PHDR
+	ret = slash_dl_tables(&tables, &ntables);
+	if (ret < 0) {
+		free(tables);
+		return ret;
+	}
+#endif
+
+	count = 1 + slash_registry_count;
+	for (i = 0; i < ntables; i++)
+		count += tables[i].stop - tables[i].start;
+
+	/* Use generated table if it matches the linked command table */
+	if (ntables == 1 && !slash_registry_count &&
+	    &slash_command_table_count && slash_command_table_count == count) {
+		nodes = NULL;
+		goto done;
+	}
+
+	if (count > UINT16_MAX) {
+		ret = -E2BIG;
+		goto err;
+	}
+
+	nodes = malloc(count * sizeof(*nodes));
+	if (!nodes) {
+		ret = -ENOMEM;
+		goto err;
+	}
+
+	memset(&nodes[0], 0, sizeof(nodes[0]));
+	node = &nodes[1];
+	for (i = 0; i < ntables; i++) {
+		for (cmd = tables[i].start; cmd < tables[i].stop; cmd++) {
+			ret = slash_node_init(node++, cmd);
+			if (ret < 0)
+				goto err_nodes;
+		}
+	}
+	for (i = 0; i < slash_registry_size; i++) {
+		if (!slash_registry[i].command)
+			continue;
+		ret = slash_node_init(node++, slash_registry[i].command);
+		if (ret < 0)
+			goto err_nodes;
+	}
+
+	qsort(&nodes[1], count - 1, sizeof(*nodes), slash_node_cmp);
+
+	/* Children of each node follow in the same order as their parents */
+	next = 1;
+	for (i = 0; i < count; i++) {
+		nodes[i].child = next;
+		while (next < count &&
+		       nodes[next].command->parent == nodes[i].command)
+			next++;
+		nodes[i].children = next - nodes[i].child;
+	}
+
+done:
+	shown = slash_level_build(nodes ? nodes : slash_command_table, count);
+	if (!shown) {
+		ret = -ENOMEM;
+		goto err_nodes;
+	}
+
+	free(slash_level_shown);
+	slash_level_shown = shown;
+	free(slash_nodes_ram);
+	slash_nodes_ram = nodes;
+	slash_nodes = nodes ? nodes : slash_command_table;
+	slash_node_count = count;
+	free(slash_tables);
+	slash_tables = tables;
+	slash_tables_count = ntables;
+	slash_index_dirty = false;
+	slash_index_generation++;
+
+	/* Words refer to nodes, so apropos builds them again if this fails */
+	if (slash_keywords && slash_keyword_build() < 0) {
+		free(slash_keywords);
+		slash_keywords = NULL;
+	}
+
+	return 0;
+
+err_nodes:
+	free(nodes);
+err:
+	free(tables);
+	return ret;
+}
+
+/* Rebuild index if shared objects have been loaded or unloaded since last build */
+static int slash_index_update(void)
+{
+#ifdef SLASH_HAVE_DL_ITERATE_PHDR
+	unsigned long long generation = slash_dl_generation;
+
+	dl_iterate_phdr(slash_dl_generation_get, &generation);
+	if (generation != slash_dl_generation)
+		slash_index_dirty = true;
+#endif
+	if (slash_index_dirty || !slash_nodes)
+		return slash_index_build();
+
+	return 0;
+}
+
+static int slash_node_name_cmp(const char *token, size_t tokenlen,
+			       uint32_t prefix, const struct slash_node *node)
+{
+	size_t len;
+	int ret;
+
+	/* Most comparisons are decided by the prefix in the index */
+	if (prefix != node->prefix)
+		return prefix < node->prefix ? -1 : 1;
+
+	len = tokenlen < node->namelen ? tokenlen : node->namelen;
+	if (len > 4) {
+		ret = memcmp(&token[4], &node->command->name[4], len - 4);
+		if (ret)
+			return ret;
+	}
+
+	if (tokenlen != node->namelen)
+		return tokenlen < node->namelen ? -1 : 1;
+
+	return 0;
+}
+
+static bool slash_node_name_match(const char *token, size_t tokenlen,
+				  uint32_t prefix, const struct slash_node *node)
+{
+	uint32_t mask;
+
+	if (tokenlen > node->namelen)
+		return false;
+
+	/* Compare the bytes of the token held in the prefix */
+	mask = tokenlen >= 4 ? 0xffffffff : ~(0xffffffff >> (tokenlen * 8));
+	if (prefix != (node->prefix & mask))
+		return false;
+
+	return tokenlen <= 4 ||
+		memcmp(&token[4], &node->command->name[4], tokenlen - 4) == 0;
+}
+
+static const struct slash_node *
+slash_node_find_child(const struct slash_node *parent,
+		      const char *token, size_t tokenlen)
+{
+	size_t low, high, mid;
+	uint32_t prefix;
+	int ret;
+
+	low = parent->child;
+	high = parent->child + parent->children;
+	prefix = slash_name_prefix(token, tokenlen);
+
+	while (low < high) {
+		mid = low + (high - low) / 2;
+		ret = slash_node_name_cmp(token, tokenlen, prefix, &slash_nodes[mid]);
+		if (ret == 0)
+			return &slash_nodes[mid];
+		if (ret < 0)
+			high = mid;
+		else
+			low = mid + 1;
+	}
+
+	return NULL;
+}
+
+/* Find range of children whose name starts with token */
+static const struct slash_node *
+slash_node_find_prefix(const struct slash_node *parent,
+		       const char *token, size_t tokenlen,
+		       const struct slash_node **end)
+{
+	size_t low, high, mid;
+	uint32_t prefix;
+
+	low = parent->child;
+	high = parent->child + parent->children;
+	prefix = slash_name_prefix(token, tokenlen);
+
+	/* Find first child not ordered before token */
+	while (low < high) {
+		mid = low + (high - low) / 2;
+		if (slash_node_name_cmp(token, tokenlen, prefix, &slash_nodes[mid]) > 0)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	high = parent->child + parent->children;
+	for (mid = low; mid < high; mid++)
+		if (!slash_node_name_match(token, tokenlen, prefix, &slash_nodes[mid]))
+			break;
+
+	*end = &slash_nodes[mid];
+
+	return &slash_nodes[low];
+}
+
+/* Views */
+int slash_view_init(struct slash_view *view, slash_filter_t filter, void *arg)
+{
+	if (!filter)
+		return -EINVAL;
+
+	memset(view, 0, sizeof(*view));
+	view->filter = filter;
+	view->arg = arg;
+
+	return 0;
+}
+
+void slash_view_destroy(struct slash_view *view)
+{
+	free(view->visible);
+	view->visible = NULL;
+}
+
+void slash_set_view(struct slash *slash, struct slash_view *view)
+{
+	slash->view = view;
+}
+
+static bool slash_view_filter(const struct slash_view *view,
+			      const struct slash_command *cmd)
+{
+	/* Command is only visible if parents are also visible */
+	while (cmd) {
+		if (!view->filter(cmd, view->arg))
+			return false;
+		cmd = cmd->parent;
+	}
+
+	return true;
+}
+
+/* Rebuild visibility bitmap of view if the index has changed */
+static int slash_view_update(struct slash_view *view)
+{
+	const struct slash_node *node;
+	uint32_t *visible;
+	size_t i, words;
+
+	if (view->visible && view->generation == slash_index_generation)
+		return 0;
+
+	words = slash_bitmap_words(slash_node_count);
+	visible = realloc(view->visible, words * sizeof(*visible));
+	if (!visible) {
+		slash_view_destroy(view);
+		return -ENOMEM;
+	}
+
+	/* Parents are visited before their children in breadth-first order */
+	memset(visible, 0, words * sizeof(*visible));
+	slash_bit_set(visible, 0);
+	for (i = 0; i < slash_node_count; i++) {
+		if (!slash_bit_test(visible, i))
+			continue;
+		slash_node_for_each_child(node, &slash_nodes[i])
+			if (view->filter(node->command, view->arg))
+				slash_bit_set(visible, node - slash_nodes);
+	}
+
+	view->visible = visible;
+	view->generation = slash_index_generation;
+
+	return 0;
+}
+
+static bool slash_node_in_view(const struct slash *slash,
+			       const struct slash_node *node)
+{
+	const struct slash_view *view = slash->view;
+
+	if (!view)
+		return true;
+
+	if (view->visible && view->generation == slash_index_generation)
+		return slash_bit_test(view->visible, node - slash_nodes);
+
+	/* Bitmap could not be allocated, so check the slow way */
+	return slash_view_filter(view, node->command);
+}
+
+static bool slash_node_is_hidden(const struct slash *slash,
+				 const struct slash_node *node)
+{
+	size_t words = slash_bitmap_words(slash_node_count);
+	const uint32_t *shown = &slash_level_shown[slash->level * words];
+
+	if (!slash_bit_test(shown, node - slash_nodes))
+		return true;
+
+	return !slash_node_in_view(slash, node);
+}
+
+/* Return first node in [node, end) that is not hidden, or end */
+static const struct slash_node *
+slash_node_next(const struct slash *slash,
+		const struct slash_node *node, const struct slash_node *end)
+{
+	while (node < end && slash_node_is_hidden(slash, node))
+		node++;
+
+	return node;
+}
+
+#define slash_node_for_each_visible(slash, node, first, last)		\
+	for (node = slash_node_next(slash, first, last);		\
+	     node < (last);						\
+	     node = slash_node_next(slash, node + 1, last))
+
+#define slash_node_children_end(parent) \
+	(&slash_nodes[(parent)->child + (parent)->children])
+
+#define slash_node_for_each_visible_child(slash, node, parent)		\
+	slash_node_for_each_visible(slash, node,			\
+				    &slash_nodes[(parent)->child],	\
+				    slash_node_children_end(parent))
+
+/* Quote characters are only special at the start of an argument */
+#define slash_span_quote(c) ((c) == '\'' || (c) == '\"')
+
+/* Return length of the command list operator at p, or 0 if there is none */
+static size_t slash_chain_op(const char *p, const char *end)
+{
+	if (p >= end)
+		return 0;
+	if (*p == ';')
+		return 1;
+	if ((*p == '&' || *p == '|') && end - p >= 2 && p[1] == *p)
+		return 2;
+
+	return 0;
+}
+
+/**
+ * slash_span_next() - Find next argument in command line.
+ * @pos: Pointer to current position, updated to the end of the argument.
+ * @end: End of the command line.
+ * @span: Set to the argument without quotes.
+ * @quotes: Handle quoted arguments.
+ *
+ * The command line is not modified and need not be NUL-terminated. Unquoted
+ * arguments end at the command list operators ';', '&&' and '||', and the
+ * end of the command is reached at an operator.
+ *
+ * Return: The quote character if a quoted argument was found, 1 if an unquoted
+ * argument was found, 0 at the end of the command, or -EINVAL if a quote was
+ * not closed.
+ */
+static int slash_span_next(const char **pos, const char *end,
+			   struct slash_span *span, bool quotes)
+{
+	const char *p = *pos;
+	char quote = '\0';
+
+	/* Skip leading whitespace */
+	p = slash_scan_while(p, end, ' ');
+	if (p >= end || !*p || slash_chain_op(p, end)) {
+		*pos = p;
+		return 0;
+	}
+
+	if (quotes && slash_span_quote(*p))
+		quote = *p++;
+
+	span->str = p;
+	if (quote) {
+		p = slash_scan_until(p, end, quote, '\0');
+	} else {
+		/* A single '&' or '|' is part of the argument */
+		p = slash_scan_token(p, end);
+		while (p < end && (*p == '&' || *p == '|') && !slash_chain_op(p, end))
+			p = slash_scan_token(p + 1, end);
+	}
+	span->len = p - span->str;
+
+	if (quote) {
+		if (p >= end || *p != quote)
+			return -EINVAL;
+		p++;
+	}
+
+	*pos = p;
+
+	return quote ? quote : 1;
+}
+
+/* Find the node of a command by looking up its path */
+static const struct slash_node *
+slash_node_find_command(const struct slash_command *cmd)
+{
+	const struct slash_node *parent = slash_node_root(), *node;
+
+	if (cmd->parent) {
+		parent = slash_node_find_command(cmd->parent);
+		if (!parent)
+			return NULL;
+	}
+
+	node = slash_node_find_child(parent, cmd->name,
+				     cmd->namelen ? cmd->namelen : strlen(cmd->name));
+
+	return node && node->command == cmd ? node : NULL;
+}
+
+int slash_command_register(struct slash_command *command)
+{
+	struct slash_registry_entry entry = { command, 0 }, *parent = NULL;
+	const struct slash_node *node = NULL;
+	int ret;
+
+	if (!command || !command->name || !command->name[0])
+		return -EINVAL;
+
+	ret = slash_index_update();
+	if (ret < 0)
+		return ret;
+
+	if (slash_registry_find(command) || slash_command_in_tables(command))
+		return -EEXIST;
+
+	/* Parent must be known, so the command can be placed in the index */
+	if (command->parent) {
+		parent = slash_registry_find(command->parent);
+		if (!parent && !slash_command_in_tables(command->parent))
+			return -EINVAL;
+		node = slash_node_find_command(command->parent);
+	}
+
+	/* Names are unique among the children of a command */
+	if (slash_node_find_child(node ? node : slash_node_root(), command->name,
+				  command->namelen ? command->namelen :
+				  strlen(command->name)))
+		return -EEXIST;
+
+	/* Keep load factor at or below one half */
+	if ((slash_registry_count + 1) * 2 > slash_registry_size) {
+		ret = slash_registry_grow();
+		if (ret < 0)
+			return ret;
+		if (command->parent)
+			parent = slash_registry_find(command->parent);
+	}
+
+	slash_registry_insert(&entry);
+	slash_registry_count++;
+	if (parent)
+		parent->children++;
+
+	ret = slash_index_build();
+	if (ret < 0) {
+		slash_registry_remove(slash_registry_find(command));
+		slash_registry_count--;
+		if (parent)
+			parent->children--;
+	}
+
+	return ret;
+}
+
+int slash_command_unregister(struct slash_command *command)
+{
+	struct slash_registry_entry *entry, *parent, removed;
+	int ret;
+
+	entry = slash_registry_find(command);
+	if (!entry)
+		return -ENOENT;
+
+	if (entry->children)
+		return -EBUSY;
+
+	parent = slash_registry_find(command->parent);
+	if (parent)
+		parent->children--;
+
+	removed = *entry;
+	slash_registry_remove(entry);
+	slash_registry_count--;
+
+	/* The command stays registered if it cannot be removed from the index */
+	ret = slash_index_build();
+	if (ret < 0) {
+		slash_registry_insert(&removed);
+		slash_registry_count++;
+		if (parent)
+			parent->children++;
+	}
+
+	return ret;
+}
+
+/* Test if command and all its parents are in the view and at or below the
+ * access level of the context, as when its path is looked up word by word */
+static bool slash_node_allowed(const struct slash *slash,
+			       const struct slash_node *node)
+{
+	const struct slash_command *cmd;
+
+	if (!slash_node_in_view(slash, node))
+		return false;
+
+	for (cmd = node->command; cmd; cmd = cmd->parent)
+		if (slash_command_level(cmd) > slash->level)
+			return false;
+
+	return true;
+}
+
+/* Return node of aliased command, or node itself if it is not an alias. An
+ * alias skips the path of its command, so the path is checked here. */
+static const struct slash_node *slash_node_alias(const struct slash *slash,
+						 const struct slash_node *node)
+{
+	if (!(node->command->flags & SLASH_FLAG_ALIAS))
+		return node;
+
+	if (!slash_node_allowed(slash, node))
+		return NULL;
+
+	node = slash_node_find_command(node->command->context);
+
+	return node && slash_node_allowed(slash, node) ? node : NULL;
+}
+
+/* Find child by exact name or unique visible prefix */
+static const struct slash_node *
+slash_node_resolve(const struct slash *slash, const struct slash_node *parent,
+		   const char *token, size_t tokenlen, bool *ambiguous)
+{
+	const struct slash_node *cur, *first, *last, *node, *match = NULL;
+
+	*ambiguous = false;
+
+	cur = slash_node_find_child(parent, token, tokenlen);
+	if (cur)
+		return slash_node_alias(slash, cur);
+
+	if (!slash->abbreviate)
+		return NULL;
+
+	/* Abbreviations only match commands shown in completion */
+	first = slash_node_find_prefix(parent, token, tokenlen, &last);
+	slash_node_for_each_visible(slash, cur, first, last) {
+		/* An alias and its command are not ambiguous */
+		node = slash_node_alias(slash, cur);
+		if (!node || node == match)
+			continue;
+		if (match) {
+			*ambiguous = true;
+			return NULL;
+		}
+		match = node;
+	}
+
+	return match;
+}
+
+/* Resolve token to a child command that is visible at the current level */
+static const struct slash_node *
+slash_command_step(struct slash *slash, const struct slash_node *node,
+		   const char *token, size_t tokenlen, bool *ambiguous)
+{
+	const struct slash_node *cur;
+
+	cur = slash_node_resolve(slash, node, token, tokenlen, ambiguous);
+	if (!cur)
+		return NULL;
+
+	/* Skip if command is not in the view of this console */
+	if (!slash_node_in_view(slash, cur))
+		return NULL;
+
+	/* Skip if command requires a higher access level */
+	if (slash_command_level(cur->command) > slash->level)
+		return NULL;
+
+	return cur;
+}
+
+static const struct slash_node *
+slash_command_find(struct slash *slash, const char *line, size_t linelen,
+		   const char **args, struct slash_span *ambiguous)
+{
+	const struct slash_node *cur, *node = slash_node_root();
+	const char *next = line;
+	struct slash_span token;
+	bool multiple;
+
+	while (slash_span_next(&next, line + linelen, &token, false) > 0) {
+		cur = slash_command_step(slash, node, token.str, token.len, &multiple);
+		if (multiple && ambiguous)
+			*ambiguous = token;
+		if (!cur)
+			break;
+
+		/* We found our command */
+		node = cur;
+		*args = token.str;
+	}
+
+	return node != slash_node_root() ? node : NULL;
+}
+
+/* Argument memory. Spans are allocated from the start, and argv, argument
+ * strings and schema argument structs from the end. */
+static void slash_args_set(struct slash *slash, char *mem, size_t size)
+{
+	const uintptr_t align = _Alignof(max_align_t);
+	uintptr_t start, end;
+
+	start = ((uintptr_t)mem + align - 1) & ~(align - 1);
+	end = ((uintptr_t)mem + size) & ~(align - 1);
+	if (end < start)
+		end = start;
+
+	slash->args_mem = mem;
+	slash->args_size = size;
+	slash->spans = (struct slash_span *)start;
+	slash->args_end = (char *)end;
+	slash->args_top = slash->args_end;
+	slash->argv = NULL;
+	slash->argc = 0;
+}
+
+static void slash_args_reset(struct slash *slash)
+{
+	slash->args_top = slash->args_end;
+	slash->argc = 0;
+}
+
+/* Grow argument memory of contexts from slash_create(). The memory is moved,
+ * so all arguments must be built again. */
+static int slash_args_grow(struct slash *slash)
+{
+	size_t size = slash->args_size ? slash->args_size * 2 : SLASH_ARGS_SIZE;
+	char *mem;
+
+	if (!slash->args_grow)
+		return -ENOSPC;
+
+	mem = realloc(slash->args_mem, size);
+	if (!mem)
+		return -ENOMEM;
+
+	slash_args_set(slash, mem, size);
+
+	return 0;
+}
+
+static void *slash_args_alloc(struct slash *slash, size_t size, size_t align)
+{
+	char *low = (char *)&slash->spans[slash->argc];
+	uintptr_t top;
+
+	if (size + align - 1 > (size_t)(slash->args_top - low))
+		return NULL;
+
+	top = ((uintptr_t)slash->args_top - size) & ~(uintptr_t)(align - 1);
+	slash->args_top = (char *)top;
+
+	return slash->args_top;
+}
+
+/* Return next free span, or NULL if argument memory is full */
+static struct slash_span *slash_args_span(struct slash *slash)
+{
+	if ((char *)&slash->spans[slash->argc + 1] > slash->args_top)
+		return NULL;
+
+	return &slash->spans[slash->argc];
+}
+
+/* Variables */
+#define SLASH_VAR_HEADER	4	/* Next (2 bytes), name and value length */
+
+#define slash_var_next(v)	((uint8_t)(v)[0] | (unsigned int)(uint8_t)(v)[1] << 8)
+#define slash_var_namelen(v)	((uint8_t)(v)[2])
+#define slash_var_valuelen(v)	((uint8_t)(v)[3])
+#define slash_var_name(v)	(&(v)[SLASH_VAR_HEADER])
+#define slash_var_value(v)	(&(v)[SLASH_VAR_HEADER + slash_var_namelen(v) + 1])
+#define slash_var_size(v)	(SLASH_VAR_HEADER + slash_var_namelen(v) + \
+				 slash_var_valuelen(v) + 2)
+#define slash_var_char(c)	(isalnum((unsigned char)(c)) || (c) == '_')
+
+#define slash_var_for_each(slash, var)					\
+	for (var = (slash)->vars;					\
+	     var < &(slash)->vars[(slash)->vars_used];			\
+	     var += slash_var_size(var))
+
+static void slash_var_set_next(char *var, unsigned int next)
+{
+	var[0] = next & 0xff;
+	var[1] = next >> 8;
+}
+
+static unsigned int slash_var_bucket(const char *name, size_t len)
+{
+	uint32_t hash = 2166136261u;
+
+	/* FNV-1a */
+	while (len--) {
+		hash ^= (uint8_t)*name++;
+		hash *= 16777619u;
+	}
+
+	return hash % SLASH_VAR_BUCKETS;
+}
+
+/* Return variable record, or NULL if the variable is not set */
+static char *slash_var_find(const struct slash *slash, const char *name, size_t len)
+{
+	unsigned int next = slash->var_hash[slash_var_bucket(name, len)];
+	char *var;
+
+	/* Records are linked by offset plus one, so 0 ends the chain */
+	while (next) {
+		var = &slash->vars[next - 1];
+		if (slash_var_namelen(var) == len &&
+		    !memcmp(slash_var_name(var), name, len))
+			return var;
+		next = slash_var_next(var);
+	}
+
+	return NULL;
+}
+
+/* Remove bytes from the arena, and move links to the following records */
+static void slash_var_cut(struct slash *slash, unsigned int offset, unsigned int size)
+{
+	unsigned int next, i;
+	char *cur;
+
+	memmove(&slash->vars[offset], &slash->vars[offset + size],
+		slash->vars_used - offset - size);
+	slash->vars_used -= size;
+
+	/* Links are offsets plus one, so links to records before are not moved */
+	for (i = 0; i < SLASH_VAR_BUCKETS; i++)
+		if (slash->var_hash[i] > offset)
+			slash->var_hash[i] -= size;
+
+	slash_var_for_each(slash, cur) {
+		next = slash_var_next(cur);
+		if (next > offset)
+			slash_var_set_next(cur, next - size);
+	}
+}
+
+static void slash_var_remove(struct slash *slash, char *var)
+{
+	unsigned int offset = var - slash->vars + 1;
+	unsigned int bucket, next;
+	char *prev = NULL;
+
+	/* Unlink from the hash chain */
+	bucket = slash_var_bucket(slash_var_name(var), slash_var_namelen(var));
+	next = slash->var_hash[bucket];
+	while (next != offset) {
+		prev = &slash->vars[next - 1];
+		next = slash_var_next(prev);
+	}
+	if (prev)
+		slash_var_set_next(prev, slash_var_next(var));
+	else
+		slash->var_hash[bucket] = slash_var_next(var);
+
+	slash_var_cut(slash, offset - 1, slash_var_size(var));
+}
+
+static int slash_var_store(struct slash *slash, const char *name, size_t namelen,
+			   const char *value, size_t valuelen)
+{
+	size_t size = SLASH_VAR_HEADER + namelen + valuelen + 2;
+	unsigned int bucket, shrink;
+	char *old, *var;
+
+	if (namelen > UINT8_MAX || valuelen > UINT8_MAX)
+		return -E2BIG;
+
+	old = slash_var_find(slash, name, namelen);
+
+	/* A value that fits is stored in place. It may be an argument that
+	 * points into the old value, so it is moved rather than copied. */
+	if (old && valuelen <= slash_var_valuelen(old)) {
+		shrink = slash_var_valuelen(old) - valuelen;
+		memmove(slash_var_value(old), value, valuelen);
+		slash_var_value(old)[valuelen] = '\0';
+		old[3] = valuelen;
+		if (shrink)
+			slash_var_cut(slash, slash_var_value(old) + valuelen + 1 -
+				      slash->vars, shrink);
+		return 0;
+	}
+
+	/* Otherwise the old record is removed first if the arena is full. A
+	 * longer value cannot point into it, but may point to a record after
+	 * it, which moves. */
+	if (size > slash->vars_size - slash->vars_used) {
+		if (!old || size > slash->vars_size - slash->vars_used +
+				   slash_var_size(old))
+			return -ENOSPC;
+		if (value > old && value < &slash->vars[slash->vars_used])
+			value -= slash_var_size(old);
+		slash_var_remove(slash, old);
+		old = NULL;
+	}
+
+	bucket = slash_var_bucket(name, namelen);
+
+	var = &slash->vars[slash->vars_used];
+	slash_var_set_next(var, slash->var_hash[bucket]);
+	var[2] = namelen;
+	var[3] = valuelen;
+	memcpy(slash_var_name(var), name, namelen);
+	slash_var_name(var)[namelen] = '\0';
+	memcpy(slash_var_value(var), value, valuelen);
+	slash_var_value(var)[valuelen] = '\0';
+
+	slash->var_hash[bucket] = slash->vars_used + 1;
+	slash->vars_used += size;
+
+	if (old)
+		slash_var_remove(slash, old);
+
+	return 0;
+}
+
+void slash_set_variable_memory(struct slash *slash, char *buffer, size_t size)
+{
+	if (slash->vars_alloc) {
+		free(slash->vars);
+		slash->vars_alloc = false;
+	}
+
+	/* Records are linked by 16 bit offsets */
+	slash->vars = buffer;
+	slash->vars_size = size < UINT16_MAX ? size : UINT16_MAX;
+	slash->vars_used = 0;
+	memset(slash->var_hash, 0, sizeof(slash->var_hash));
+}
+
+int slash_set_variable(struct slash *slash, const char *name, const char *value)
+{
+	size_t namelen = strlen(name);
+	char *var;
+	size_t i;
+
+	if (!namelen)
+		return -EINVAL;
+	for (i = 0; i < namelen; i++)
+		if (!slash_var_char(name[i]))
+			return -EINVAL;
+
+	if (!value) {
+		var = slash_var_find(slash, name, namelen);
+		if (!var)
+			return -ENOENT;
+		slash_var_remove(slash, var);
+		return 0;
+	}
+
+	return slash_var_store(slash, name, namelen, value, strlen(value));
+}
+
+const char *slash_get_variable(struct slash *slash, const char *name)
+{
+	char *var = slash_var_find(slash, name, strlen(name));
+
+	return var ? slash_var_value(var) : NULL;
+}
+
+/* Parse $name or ${name} reference at p, and return the end of it, or p if
+ * there is no reference */
+static const char *slash_var_ref(const char *p, const char *end,
+				 const char **name, size_t *namelen)
+{
+	const char *q = p + 1;
+	bool brace;
+
+	brace = q < end && *q == '{';
+	if (brace)
+		q++;
+
+	*name = q;
+	while (q < end && slash_var_char(*q))
+		q++;
+	*namelen = q - *name;
+
+	if (!*namelen)
+		return p;
+	if (brace) {
+		if (q >= end || *q != '}')
+			return p;
+		q++;
+	}
 
-			/* Ensure entire command name matches */
-			if (strlen(cur->name) != tokenlen)
-				continue;
+	return q;
+}
+
+/* Append n bytes to the expansion, or only count them if out is NULL */
+#define slash_var_append(out, len, str, n)				\
+	do {								\
+		if (out)						\
+			memcpy(&(out)[len], str, n);			\
+		(len) += (n);						\
+	} while (0)
+
+/* Expand variables in argument. A variable used as the whole argument is
+ * passed as a span of the variable memory, otherwise the argument is expanded
+ * into argument memory. The expanded length is found in the first pass and
+ * the expansion is copied in the second. */
+static int slash_var_expand(struct slash *slash, struct slash_span *span)
+{
+	const char *p, *end = span->str + span->len, *dollar, *ref, *name;
+	char *out = NULL, *var;
+	size_t namelen, len;
 
-			/* Skip if privileged command in non-privileged mode */
-			if (!slash->privileged &&
-			    (cur->flags & SLASH_FLAG_PRIVILEGED))
+	if (!memchr(span->str, '$', span->len))
+		return 0;
+
+	for (;;) {
+		len = 0;
+		for (p = span->str; (dollar = memchr(p, '$', end - p)); p = ref) {
+			slash_var_append(out, len, p, (size_t)(dollar - p));
+
+			ref = slash_var_ref(dollar, end, &name, &namelen);
+			if (ref == dollar) {
+				/* Not a reference, keep the dollar sign */
+				slash_var_append(out, len, "$", 1);
+				ref = dollar + 1;
 				continue;
+			}
 
-			/* We found our command */
-			command = cur;
-			*args = token;
-			found = true;
+			var = slash_var_find(slash, name, namelen);
+			if (!var) {
+				slash_printf(slash, "Undefined variable: %.*s\n",
+					     (int)namelen, name);
+				return -ENOENT;
+			}
+
+			if (dollar == span->str && ref == end) {
+				span->str = slash_var_value(var);
+				span->len = slash_var_valuelen(var);
+				return 0;
+			}
+
+			slash_var_append(out, len, slash_var_value(var),
+					 (size_t)slash_var_valuelen(var));
 		}
+		slash_var_append(out, len, p, (size_t)(end - p));
 
-		if (!found)
+		if (out)
 			break;
+
+		out = slash_args_alloc(slash, len + 1, 1);
+		if (!out)
+			return -ENOSPC;
 	}
 
-	return command;
+	out[len] = '\0';
+	span->str = out;
+	span->len = len;
+
+	return 0;
 }
 
-static int slash_build_args(struct slash *slash, char *args)
+/* Split arguments into spans, expanding variables outside single quotes */
+static int slash_build_args(struct slash *slash, const char *args,
+			    const char *end, const char **next)
 {
-	/* Quote level */
-	enum {
-		SLASH_QUOTE_NONE,
-		SLASH_QUOTE_SINGLE,
-		SLASH_QUOTE_DOUBLE,
-	} quote = SLASH_QUOTE_NONE;
+	struct slash_span *span;
+	int ret;
 
 	slash->argc = 0;
 
-	while (*args && slash->argc < SLASH_ARG_MAX) {
-		/* Check for quotes */
-		if (*args == '\'') {
-			quote = SLASH_QUOTE_SINGLE;
-			args++;
-		} else if (*args == '\"') {
-			quote = SLASH_QUOTE_DOUBLE;
-			args++;
+	for (;;) {
+		span = slash_args_span(slash);
+		if (!span)
+			return -E2BIG;
+
+		ret = slash_span_next(&args, end, span, true);
+		if (ret <= 0)
+			break;
+
+		if (slash->vars_used && ret != '\'') {
+			ret = slash_var_expand(slash, span);
+			if (ret < 0)
+				return ret;
 		}
+		slash->argc++;
+	}
 
-		/* Argument starts here */
-		slash->argv[slash->argc++] = args;
+	/* Test for quote mismatch */
+	if (ret < 0)
+		return ret;
 
-		/* Loop over input argument */
-		while (*args) {
-			if (quote == SLASH_QUOTE_SINGLE && *args == '\'') {
-				quote = SLASH_QUOTE_NONE;
-				break;
-			} else if (quote == SLASH_QUOTE_DOUBLE &&
-				   *args == '\"') {
-				quote = SLASH_QUOTE_NONE;
-				break;
-			} else if (quote == SLASH_QUOTE_NONE && *args == ' ') {
-				break;
-			}
+	*next = args;
 
-			args++;
-		}
+	return 0;
+}
+
+/* Return end of the command starting at p, i.e. the next operator or end */
+static const char *slash_chain_skip(const char *p, const char *end)
+{
+	struct slash_span span;
+	int ret;
 
-		/* End argument with zero byte */
-		if (*args)
-			*args++ = '\0';
+	while ((ret = slash_span_next(&p, end, &span, true)) > 0)
+		;
 
-		/* Skip trailing white space */
-		while (*args && *args == ' ')
-			args++;
+	return ret < 0 ? end : p;
+}
+
+/* Test if string is in memory [mem, mem + size) */
+#define slash_owned(str, mem, size) \
+	((mem) && (str) >= (mem) && (str) < (mem) + (size))
+
+/* Make NUL-terminated argv, copying arguments to argument memory. Expanded
+ * arguments are used in place, unless copy is set. With spans set, argv only
+ * holds NULL values. */
+static int slash_build_argv(struct slash *slash, bool copy, bool spans)
+{
+	struct slash_span *span;
+	char *p;
+	int i;
+
+	slash->argv = slash_args_alloc(slash, (slash->argc + 1) * sizeof(char *),
+				       _Alignof(char *));
+	if (!slash->argv)
+		return -ENOSPC;
+
+	if (spans) {
+		memset(slash->argv, 0, (slash->argc + 1) * sizeof(char *));
+		return 0;
 	}
 
-	/* Test for quote mismatch */
-	if (quote != SLASH_QUOTE_NONE)
-		return -EINVAL;
+	for (i = 0; i < slash->argc; i++) {
+		span = &slash->spans[i];
+		if (slash_owned(span->str, slash->args_top, slash->args_end - slash->args_top) ||
+		    (!copy && slash_owned(span->str, slash->vars, slash->vars_size))) {
+			slash->argv[i] = (char *)span->str;
+			continue;
+		}
 
-	/* If args does not point to NULL, we ran out of argv space */
-	if (*args)
-		return -E2BIG;
+		p = slash_args_alloc(slash, span->len + 1, 1);
+		if (!p)
+			return -ENOSPC;
+		memcpy(p, span->str, span->len);
+		p[span->len] = '\0';
+		slash->argv[i] = p;
+	}
 
 	/* According to C11 section 5.1.2.2.1, argv[argc] must be NULL */
 	slash->argv[slash->argc] = NULL;
@@ -459,6 +3211,27 @@ static void slash_command_name_recurse(struct slash *slash, struct slash_command
 	slash_printf(slash, "%s", command->name);
 }
 
+static void slash_schema_usage(struct slash *slash,
+			       const struct slash_schema *schema)
+{
+	const struct slash_arg *arg;
+	const char *const *value;
+	unsigned int i;
+
+	for (i = 0; i < schema->count; i++) {
+		arg = &schema->args[i];
+		slash_printf(slash, i < schema->required ? " <" : " [");
+		if (arg->type == SLASH_ARG_ENUM) {
+			for (value = arg->values; *value; value++)
+				slash_printf(slash, "%s%s",
+					     value != arg->values ? "|" : "", *value);
+		} else {
+			slash_printf(slash, "%s", arg->name);
+		}
+		slash_printf(slash, i < schema->required ? ">" : "]");
+	}
+}
+
 static void slash_command_usage(struct slash *slash, struct slash_command *command)
 {
 	const char *args = command->args ? command->args : "";
@@ -466,93 +3239,417 @@ static void slash_command_usage(struct slash *slash, struct slash_command *comma
 
 	slash_printf(slash, "%s: ", type);
 	slash_command_name_recurse(slash, command);
-	slash_printf(slash, " %s\n", args);
+	if (command->schema) {
+		slash_schema_usage(slash, command->schema);
+		slash_printf(slash, "\n");
+	} else {
+		slash_printf(slash, " %s\n", args);
+	}
 }
 
-static void slash_command_description(struct slash *slash, struct slash_command *command)
+/* Help text, optionally compressed by tools/slashgen.py */
+#define SLASH_HELP_ESCAPE	0x01	/* Next byte is a literal character */
+#define SLASH_HELP_WORD		0x80	/* First byte value used for dictionary words */
+
+#ifdef SLASH_COMPRESS_HELP
+extern const char slash_help_dict[] __attribute__((weak));
+extern const uint16_t slash_help_dict_offset[] __attribute__((weak));
+#endif
+
+struct slash_text {
+	const unsigned char *next;
+	const unsigned char *word;
+	bool compressed;
+};
+
+static void slash_text_init(struct slash_text *text, const char *str,
+			    bool compressed)
 {
-	char *nl;
-	const char *help = "";
-	size_t desclen = 0;
+	text->next = (const unsigned char *)(str ? str : "");
+	text->word = NULL;
+	text->compressed = compressed;
+}
 
-	/* Extract first line from help as description */
-	if (command->help != NULL) {
-		help = command->help;
-		nl = strchr(help, '\n');
-		desclen = nl ? (size_t)(nl - help) : strlen(help);
+static void slash_text_help(struct slash_text *text,
+			    const struct slash_command *command)
+{
+	slash_text_init(text, command->help,
+			command->flags & SLASH_FLAG_COMPRESSED);
+}
+
+/* Return next character of text, or 0 at the end of text */
+static int slash_text_getc(struct slash_text *text)
+{
+	int c;
+
+#ifdef SLASH_COMPRESS_HELP
+	if (text->word) {
+		c = *text->word++;
+		if (c)
+			return c;
+		text->word = NULL;
+	}
+#endif
+
+	c = *text->next;
+	if (!c)
+		return 0;
+	text->next++;
+
+#ifdef SLASH_COMPRESS_HELP
+	if (text->compressed && c == SLASH_HELP_ESCAPE) {
+		c = *text->next++;
+	} else if (text->compressed && c >= SLASH_HELP_WORD) {
+		/* Dictionary words are never empty */
+		text->word = (const unsigned char *)
+			&slash_help_dict[slash_help_dict_offset[c - SLASH_HELP_WORD]];
+		c = *text->word++;
+	}
+#endif
+
+	return c;
+}
+
+/* Print text, or only its first line, and return the last character printed */
+static int slash_text_print(struct slash *slash, struct slash_text *text,
+			    bool first_line)
+{
+	char buf[32];
+	size_t len = 0;
+	int c, last = 0;
+
+	while ((c = slash_text_getc(text))) {
+		if (first_line && c == '\n')
+			break;
+		buf[len++] = last = c;
+		if (len == sizeof(buf)) {
+			slash_printf(slash, "%.*s", (int)len, buf);
+			len = 0;
+		}
 	}
 
-	slash_printf(slash, "%-15s %.*s\n", command->name, desclen, help);
+	if (len)
+		slash_printf(slash, "%.*s", (int)len, buf);
+
+	return last;
+}
+
+static void slash_command_description(struct slash *slash, struct slash_command *command)
+{
+	struct slash_text help;
+
+	slash_printf(slash, "%-15s ", command->name);
+
+	/* Aliases without help use the help of the aliased command */
+	if (command->help == NULL && (command->flags & SLASH_FLAG_ALIAS))
+		command = command->context;
+
+	/* Extract first line from help as description */
+	slash_text_help(&help, command);
+	slash_text_print(slash, &help, true);
+	slash_printf(slash, "\n");
 }
 
-static void slash_command_help(struct slash *slash, struct slash_command *command)
+static void slash_schema_help(struct slash *slash,
+			      const struct slash_schema *schema)
 {
-	size_t slen;
-	const char *help = "";
-	struct slash_command *cur;
-	bool first = true;
+	const struct slash_arg *arg;
+	const char *const *value;
+	unsigned int i;
+
+	slash_printf(slash, "\nArguments:\n");
+	for (i = 0; i < schema->count; i++) {
+		arg = &schema->args[i];
+		slash_printf(slash, "  %-13s ", arg->name);
+		switch (arg->type) {
+		case SLASH_ARG_INT:
+			slash_printf(slash, "integer from %ld to %ld",
+				     arg->range.min, arg->range.max);
+			break;
+		case SLASH_ARG_HEX:
+			slash_printf(slash, "hex from 0x%lx to 0x%lx",
+				     arg->urange.min, arg->urange.max);
+			break;
+		case SLASH_ARG_FLOAT:
+			slash_printf(slash, "number from %g to %g",
+				     arg->frange.min, arg->frange.max);
+			break;
+		case SLASH_ARG_ENUM:
+			slash_printf(slash, "one of");
+			for (value = arg->values; *value; value++)
+				slash_printf(slash, "%s %s",
+					     value != arg->values ? "," : "", *value);
+			break;
+		case SLASH_ARG_STRING:
+			slash_printf(slash, "string");
+			break;
+		}
+		slash_printf(slash, "%s\n", i < schema->required ? "" : " (optional)");
+	}
+}
 
-	if (command->help != NULL)
-		help = command->help;
+static void slash_command_help(struct slash *slash, const struct slash_node *node)
+{
+	struct slash_text help;
+	struct slash_command *command = node->command;
+	const struct slash_node *cur;
+	int last;
 
 	slash_command_usage(slash, command);
-	slash_printf(slash, "\n%s", help);
+	slash_printf(slash, "\n");
 
-	slen = strlen(help);
-	if (slen > 0 && help[slen - 1] != '\n')
+	slash_text_help(&help, command);
+	last = slash_text_print(slash, &help, false);
+	if (last && last != '\n')
 		slash_printf(slash, "\n");
 
-	slash_command_list_for_each(cur) {
-		if (cur->parent == command) {
-			if (first) {
-				slash_printf(slash,
-					     "\nAvailable subcommands in \'%s\' group:\n",
-					     command->name);
-				first = false;
+	if (command->schema)
+		slash_schema_help(slash, command->schema);
+
+	cur = slash_node_next(slash, &slash_nodes[node->child],
+			      slash_node_children_end(node));
+	if (cur < slash_node_children_end(node))
+		slash_printf(slash, "\nAvailable subcommands in \'%s\' group:\n",
+			     command->name);
+
+	slash_node_for_each_visible_child(slash, cur, node)
+		slash_command_description(slash, cur->command);
+}
+
+/* Convert argument string into field of argument struct */
+static int slash_arg_parse(struct slash *slash, const struct slash_arg *arg,
+			   char *str, void *field)
+{
+	const char *const *value;
+	unsigned long ul;
+	char *end;
+	double d;
+	long l;
+
+	errno = 0;
+	switch (arg->type) {
+	case SLASH_ARG_INT:
+		l = strtol(str, &end, 0);
+		if (end == str || *end || errno)
+			break;
+		if (l < arg->range.min || l > arg->range.max)
+			goto range;
+		*(long *)field = l;
+		return 0;
+	case SLASH_ARG_HEX:
+		ul = strtoul(str, &end, 16);
+		if (end == str || *end || errno || *str == '-')
+			break;
+		if (ul < arg->urange.min || ul > arg->urange.max)
+			goto range;
+		*(unsigned long *)field = ul;
+		return 0;
+	case SLASH_ARG_FLOAT:
+		d = strtod(str, &end);
+		if (end == str || *end || errno || d != d)
+			break;
+		if (d < arg->frange.min || d > arg->frange.max)
+			goto range;
+		*(double *)field = d;
+		return 0;
+	case SLASH_ARG_ENUM:
+		for (value = arg->values; *value; value++) {
+			if (!strcmp(str, *value)) {
+				*(int *)field = value - arg->values;
+				return 0;
 			}
-			slash_command_description(slash, cur);
 		}
+		break;
+	case SLASH_ARG_STRING:
+		*(char **)field = str;
+		return 0;
 	}
+
+	slash_printf(slash, "Invalid value for argument '%s': %s\n", arg->name, str);
+	return -EINVAL;
+
+range:
+	slash_printf(slash, "Value out of range for argument '%s': %s\n", arg->name, str);
+	return -ERANGE;
 }
 
-int slash_execute(struct slash *slash, char *line)
+/* Convert arguments into the zero-initialized argument struct */
+static int slash_schema_parse(struct slash *slash,
+			      const struct slash_schema *schema)
 {
-	struct slash_command *command, *cur;
-	char *args;
+	unsigned int i, nargs = slash->argc - 1;
 	int ret;
 
-	/* Fast path for empty lines or comments */
-	if (slash_line_empty_or_comment(line, strlen(line)))
-		return 0;
+	if (nargs < schema->required) {
+		slash_printf(slash, "Missing argument '%s'\n", schema->args[nargs].name);
+		return -EINVAL;
+	}
+
+	if (nargs > schema->count) {
+		slash_printf(slash, "Too many arguments\n");
+		return -E2BIG;
+	}
+
+	for (i = 0; i < nargs; i++) {
+		ret = slash_arg_parse(slash, &schema->args[i], slash->argv[i + 1],
+				      (char *)slash->params + schema->args[i].offset);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+/* Point string arguments at the arguments of the context, after the converted
+ * arguments have been copied to new argument memory */
+static void slash_schema_relocate(struct slash *slash,
+				  const struct slash_schema *schema)
+{
+	unsigned int i, nargs = slash->argc - 1;
+
+	for (i = 0; i < nargs; i++)
+		if (schema->args[i].type == SLASH_ARG_STRING)
+			*(char **)((char *)slash->params + schema->args[i].offset) =
+				slash->argv[i + 1];
+}
+
+/* Report lookup errors, or return 0 if node is an executable command */
+static int slash_command_check(struct slash *slash, const struct slash_node *node,
+			       const struct slash_span *ambiguous,
+			       const char *line, size_t len)
+{
+	const struct slash_node *cur, *first, *last;
+
+	if (ambiguous->str) {
+		slash_printf(slash, "Ambiguous command: %.*s\n",
+			     (int)ambiguous->len, ambiguous->str);
+		first = slash_node_find_prefix(node ? node : slash_node_root(),
+					       ambiguous->str, ambiguous->len, &last);
+		slash_node_for_each_visible(slash, cur, first, last)
+			slash_command_description(slash, cur->command);
+		return -ENOENT;
+	}
 
-	command = slash_command_find(slash, line, strlen(line), &args);
-	if (!command) {
-		slash_printf(slash, "No such command: %s\n", line);
+	if (!node) {
+		slash_printf(slash, "No such command: %.*s\n", (int)len, line);
 		return -ENOENT;
 	}
 
-	if (!command->func) {
+	if (!node->command->func) {
 		slash_printf(slash, "Available subcommands in \'%s\' group:\n",
-			     command->name);
-		slash_command_list_for_each(cur) {
-			if (cur->parent == command)
-				slash_command_description(slash, cur);
-		}
+			     node->command->name);
+		slash_node_for_each_visible_child(slash, cur, node)
+			slash_command_description(slash, cur->command);
 		return -EISDIR;
 	}
 
-	/* Build args */
-	ret = slash_build_args(slash, args);
+	return 0;
+}
+
+/* Allocate the schema argument struct of the command */
+static int slash_command_params(struct slash *slash,
+				const struct slash_command *command)
+{
+	const struct slash_schema *schema = command->schema;
+
+	slash->params = NULL;
+	if (!schema)
+		return 0;
+
+	slash->params = slash_args_alloc(slash, schema->size, _Alignof(max_align_t));
+	if (!slash->params)
+		return -ENOSPC;
+
+	memset(slash->params, 0, schema->size);
+
+	return 0;
+}
+
+/* Convert the arguments of the command according to its schema */
+static int slash_command_convert(struct slash *slash,
+				 struct slash_command *command)
+{
+	int ret;
+
+	if (!command->schema)
+		return 0;
+
+	ret = slash_schema_parse(slash, command->schema);
+	if (ret < 0)
+		slash_command_usage(slash, command);
+
+	return ret;
+}
+
+/* Find the first command of the line and build its arguments in the context.
+ * The end of the command is returned in next. With spans set, argv is only
+ * built if needed, and variables are used in place. */
+static int slash_command_parse(struct slash *slash, const char *line,
+			       size_t len, const struct slash_node **found,
+			       bool spans, const char **next)
+{
+	struct slash_command *command;
+	const struct slash_node *node;
+	struct slash_span ambiguous = {0};
+	const char *args, *end = line + len;
+	int ret;
+
+	ret = slash_index_update();
+	if (ret < 0)
+		return ret;
+	if (slash->view)
+		slash_view_update(slash->view);
+
+	node = slash_command_find(slash, line, len, &args, &ambiguous);
+	if (!node || ambiguous.str || !node->command->func) {
+		/* Report the command without the trailing operator */
+		*next = slash_chain_skip(line, end);
+		len = *next - line;
+		while (len > 0 && line[len - 1] == ' ')
+			len--;
+		return slash_command_check(slash, node, &ambiguous, line, len);
+	}
+
+	/* Build args, argv and the schema argument struct, and start over with
+	 * more memory if they do not fit */
+	command = node->command;
+	do {
+		slash_args_reset(slash);
+		ret = slash_build_args(slash, args, end, next);
+		if (ret == 0)
+			ret = slash_build_argv(slash, !spans, spans &&
+					       (command->flags & SLASH_FLAG_SPANS) &&
+					       !command->schema);
+		if (ret == 0)
+			ret = slash_command_params(slash, command);
+	} while ((ret == -E2BIG || ret == -ENOSPC) && slash_args_grow(slash) == 0);
+
 	if (ret < 0) {
-		if (ret == -EINVAL)
+		*next = slash_chain_skip(line, end);
+		if (ret == -ENOENT)
+			; /* Undefined variable reported during expansion */
+		else if (ret == -EINVAL)
 			slash_printf(slash, "Mismatched quotes\n");
 		else if (ret == -E2BIG)
 			slash_printf(slash, "Too many arguments\n");
+		else if (ret == -ENOSPC)
+			slash_printf(slash, "Arguments too long\n");
 		else
 			slash_printf(slash, "Invalid arguments\n");
 		return ret;
 	}
 
+	*found = node;
+
+	return slash_command_convert(slash, command);
+}
+
+/* Call command with the arguments in the context */
+static int slash_command_call(struct slash *slash, const struct slash_node *node)
+{
+	struct slash_command *command = node->command;
+	int ret;
+
 	/* Reset state for slash_getopt */
 	slash->optarg = 0;
 	slash->optind = 1;
@@ -568,30 +3665,266 @@ int slash_execute(struct slash *slash, char *line)
 	if (ret == SLASH_EUSAGE)
 		slash_command_usage(slash, command);
 	else if (ret == SLASH_EHELP)
-		slash_command_help(slash, command);
+		slash_command_help(slash, node);
+
+	return ret;
+}
+
+static int slash_execute_command(struct slash *slash, const char *line,
+				 const char *end, const char **next)
+{
+	const struct slash_node *node;
+	int ret;
+
+	ret = slash_command_parse(slash, line, end - line, &node, true, next);
+	if (ret < 0)
+		return ret;
+
+	return slash_command_call(slash, node);
+}
+
+int slash_execute_len(struct slash *slash, const char *line, size_t len)
+{
+	const char *end = line + len, *next, *p;
+	int ret = SLASH_SUCCESS;
+	size_t oplen;
+	char op = ';';
+
+	/* Fast path for empty lines or comments */
+	if (slash_line_empty_or_comment(line, len))
+		return 0;
+
+	/* Commands are parsed in place, and each command ends where the next
+	 * operator starts, so the line is scanned once. Skipped commands and
+	 * empty commands leave the status of the previous command. */
+	for (;;) {
+		p = slash_scan_while(line, end, ' ');
+		if (p < end && *p == '#')
+			next = end;
+		else if (p >= end || !*p || slash_chain_op(p, end))
+			next = p;
+		else if (op == ';' || (op == '&') == (ret == SLASH_SUCCESS))
+			ret = slash_execute_command(slash, line, end, &next);
+		else
+			next = slash_chain_skip(line, end);
+
+		/* Exit ends the list, so the loop sees it */
+		oplen = slash_chain_op(next, end);
+		if (!oplen || ret == SLASH_EXIT)
+			return ret;
+
+		op = *next;
+		line = next + oplen;
+	}
+}
+
+int slash_execute(struct slash *slash, const char *line)
+{
+	return slash_execute_len(slash, line, strlen(line));
+}
+
+int slash_execute_argv(struct slash *slash, int argc, char **argv)
+{
+	const struct slash_node *cur, *node = slash_node_root();
+	struct slash_span ambiguous = {0};
+	bool multiple;
+	int i, first = 0, ret;
+
+	if (argc < 1)
+		return 0;
+
+	ret = slash_index_update();
+	if (ret < 0)
+		return ret;
+	if (slash->view)
+		slash_view_update(slash->view);
+
+	/* Each argument is a word of the command path until no command matches */
+	for (i = 0; i < argc; i++) {
+		cur = slash_command_step(slash, node, argv[i], strlen(argv[i]),
+					 &multiple);
+		if (multiple) {
+			ambiguous.str = argv[i];
+			ambiguous.len = strlen(argv[i]);
+		}
+		if (!cur)
+			break;
+		node = cur;
+		first = i;
+	}
+
+	if (node == slash_node_root())
+		node = NULL;
+	ret = slash_command_check(slash, node, &ambiguous, argv[0], strlen(argv[0]));
+	if (ret < 0)
+		return ret;
+
+	/* Arguments are used in place */
+	argc -= first;
+	do {
+		slash_args_reset(slash);
+		ret = 0;
+		if ((char *)&slash->spans[argc] > slash->args_top) {
+			ret = -E2BIG;
+			continue;
+		}
+		slash->argc = argc;
+		slash->argv = slash_args_alloc(slash, (argc + 1) * sizeof(char *),
+					       _Alignof(char *));
+		if (!slash->argv)
+			ret = -E2BIG;
+		else
+			ret = slash_command_params(slash, node->command);
+	} while (ret < 0 && slash_args_grow(slash) == 0);
+
+	if (ret < 0) {
+		slash_printf(slash, "Too many arguments\n");
+		return ret;
+	}
+
+	for (i = 0; i < argc; i++) {
+		slash->argv[i] = argv[first + i];
+		slash->spans[i].str = argv[first + i];
+		slash->spans[i].len = strlen(argv[first + i]);
+	}
+	slash->argv[argc] = NULL;
+
+	ret = slash_command_convert(slash, node->command);
+	if (ret < 0)
+		return ret;
+
+	return slash_command_call(slash, node);
+}
+
+int slash_prepare(struct slash *slash, struct slash_prepared *prepared,
+		  const char *line)
+{
+	const uintptr_t align = _Alignof(max_align_t);
+	const struct slash_node *node;
+	size_t len = strlen(line);
+	const char *next;
+	char *base;
+	int i, ret;
+
+	prepared->command = NULL;
+	if (slash_line_empty_or_comment(line, len))
+		return 0;
+
+	/* Parse in the context and keep a copy of the result */
+	ret = slash_command_parse(slash, line, len, &node, false, &next);
+	if (ret < 0)
+		return ret;
+
+	if (slash_chain_op(next, line + len)) {
+		slash_printf(slash, "Command lists cannot be prepared\n");
+		return -EINVAL;
+	}
+
+	/* Copy from an aligned base, so the copy keeps the alignment */
+	base = (char *)((uintptr_t)slash->args_top & ~(align - 1));
+	if (slash->argc > SLASH_ARG_MAX ||
+	    (size_t)(slash->args_end - base) > SLASH_SCRATCH_SIZE) {
+		slash_printf(slash, "Command too long to prepare\n");
+		return -E2BIG;
+	}
+
+	prepared->command = node->command;
+	prepared->node = node - slash_nodes;
+	prepared->generation = slash_index_generation;
+	prepared->argc = slash->argc;
+	prepared->used = slash->args_end - base;
+	prepared->argv = (char *)slash->argv - base;
+	prepared->params = slash->params ? (char *)slash->params - base + 1 : 0;
+	memcpy(prepared->scratch, base, prepared->used);
+
+	for (i = 0; i < slash->argc; i++) {
+		prepared->offset[i] = slash->argv[i] - base;
+		prepared->length[i] = slash->spans[i].len;
+	}
+
+	return 0;
+}
+
+int slash_run(struct slash *slash, struct slash_prepared *prepared)
+{
+	struct slash_command *command = prepared->command;
+	const struct slash_node *node;
+	char *base;
+	int i, ret;
+
+	if (!command)
+		return 0;
+
+	ret = slash_index_update();
+	if (ret < 0)
+		return ret;
+	if (slash->view)
+		slash_view_update(slash->view);
+
+	/* Find the node again if the index has been rebuilt */
+	if (prepared->generation != slash_index_generation) {
+		node = slash_node_find_command(command);
+		if (!node) {
+			slash_printf(slash, "No such command: %s\n", command->name);
+			return -ENOENT;
+		}
+		prepared->node = node - slash_nodes;
+		prepared->generation = slash_index_generation;
+	}
+
+	/* The view and level may have changed since the command was prepared,
+	 * for the command or any of its parents */
+	node = &slash_nodes[prepared->node];
+	if (!slash_node_allowed(slash, node)) {
+		slash_printf(slash, "No such command: %s\n", command->name);
+		return -ENOENT;
+	}
+
+	do {
+		slash_args_reset(slash);
+		slash->argc = prepared->argc;
+		base = NULL;
+		if ((char *)&slash->spans[slash->argc] <= slash->args_top)
+			base = slash_args_alloc(slash, prepared->used,
+						_Alignof(max_align_t));
+	} while (!base && slash_args_grow(slash) == 0);
+
+	if (!base) {
+		slash_printf(slash, "Arguments too long\n");
+		return -ENOSPC;
+	}
 
-	return ret;
+	memcpy(base, prepared->scratch, prepared->used);
+	slash->argv = (char **)&base[prepared->argv];
+	for (i = 0; i < prepared->argc; i++) {
+		slash->argv[i] = &base[prepared->offset[i]];
+		slash->spans[i].str = slash->argv[i];
+		slash->spans[i].len = prepared->length[i];
+	}
+	slash->argv[slash->argc] = NULL;
+	slash->params = NULL;
+	if (prepared->params) {
+		slash->params = &base[prepared->params - 1];
+		slash_schema_relocate(slash, command->schema);
+	}
+
+	return slash_command_call(slash, node);
 }
 
 /* Completion */
 static char *slash_last_word(char *line, size_t len, size_t *lastlen)
 {
-	char *word;
-
-	word = &line[len];
-	*lastlen = 0;
+	const char *space;
+	size_t start = 0;
 
-	while (word > line && *word != ' ') {
-		word--;
-		(*lastlen)++;
-	}
+	/* The word starts after the last space, not counting the first byte */
+	space = slash_scan_back(line + 1, line + len + 1, ' ');
+	if (space)
+		start = space - line + 1;
 
-	if (word != line) {
-		word++;
-		(*lastlen)--;
-	}
+	*lastlen = len - start;
 
-	return word;
+	return &line[start];
 }
 
 static bool slash_complete_confirm(struct slash *slash, int matches)
@@ -640,28 +3973,18 @@ static void slash_set_completion(struct slash *slash,
 	slash->cursor = slash->length;
 }
 
-static bool slash_complete_matches(struct slash *slash,
-				   struct slash_command *command,
-				   struct slash_command *cur,
-				   char *complete, size_t completelen)
-{
-	if (cur->parent != command)
-		return false;
-
-	if (slash_command_is_hidden(slash, cur))
-		return false;
-
-	if (strncmp(cur->name, complete, completelen) != 0)
-		return false;
-
-	return true;
-}
-
 static void slash_complete(struct slash *slash)
 {
 	size_t completelen = 0, commandlen = 0, prefixlen = 0, matches;
-	char *complete, *args;
-	struct slash_command *cur, *command = NULL, *prefix = NULL;
+	char *complete;
+	const char *args;
+	const struct slash_node *cur, *first, *last, *node = slash_node_root();
+	struct slash_command *prefix = NULL;
+
+	if (slash_index_update() < 0)
+		return;
+	if (slash->view)
+		slash_view_update(slash->view);
 
 	/* Find start of word to complete */
 	complete = slash_last_word(slash->buffer, slash->cursor, &completelen);
@@ -669,34 +3992,31 @@ static void slash_complete(struct slash *slash)
 
 	/* Determine if we are completing sub command */
 	if (!slash_line_empty(slash->buffer, commandlen)) {
-		command = slash_command_find(slash, slash->buffer, commandlen, &args);
-		if (!command || slash_command_is_hidden(slash, command))
+		node = slash_command_find(slash, slash->buffer, commandlen, &args, NULL);
+		if (!node || slash_node_is_hidden(slash, node))
 			return;
 	}
 
-	/* Search list for matches */
+	/* Search children for matches */
 	matches = 0;
-	slash_command_list_for_each(cur) {
-		if (!slash_complete_matches(slash, command, cur,
-					    complete, completelen))
-			continue;
-
+	first = slash_node_find_prefix(node, complete, completelen, &last);
+	slash_node_for_each_visible(slash, cur, first, last) {
 		matches++;
 
 		/* Find common prefix */
 		if (!prefix) {
-			prefix = cur;
-			prefixlen = strlen(prefix->name);
+			prefix = cur->command;
+			prefixlen = cur->namelen;
 		} else {
-			prefixlen = slash_prefix_length(prefix->name, cur->name);
+			prefixlen = slash_prefix_length(prefix->name, cur->command->name);
 		}
 	}
 
 	/* Complete or list matches */
 	if (!matches) {
-		if (command) {
+		if (node != slash_node_root()) {
 			slash_printf(slash, "\n");
-			slash_command_usage(slash, command);
+			slash_command_usage(slash, node->command);
 			slash->refresh_full = true;
 		} else {
 			slash_bell(slash);
@@ -710,13 +4030,8 @@ static void slash_complete(struct slash *slash)
 		slash_printf(slash, "\n");
 		if (slash_complete_confirm(slash, matches)) {
 			/* List matches */
-			slash_command_list_for_each(cur) {
-				if (!slash_complete_matches(slash, command, cur,
-							    complete, completelen))
-					continue;
-
-				slash_command_description(slash, cur);
-			}
+			slash_node_for_each_visible(slash, cur, first, last)
+				slash_command_description(slash, cur->command);
 		}
 		slash->refresh_full = true;
 	}
@@ -928,13 +4243,19 @@ static bool slash_history_previous(struct slash *slash)
 /* Line editing */
 static int slash_screen_cursor_back(struct slash *slash, size_t n)
 {
+	char esc[24];
+	int len;
+
 	/* If we need to move more than 3 colums, CUB uses fewer bytes */
 	if (n > 3) {
-		slash_printf(slash, ESCAPE("%zuD"), n);
+		len = slash_snprintf(esc, sizeof(esc), ESCAPE("%zuD"), n);
+		if (slash_frame_write(slash, esc, len) < 0)
+			return -1;
 		slash->cursor_screen -= n;
 	} else {
 		while (n--) {
-			slash_putchar(slash, '\b');
+			if (slash_frame_putchar(slash, '\b') < 0)
+				return -1;
 			slash->cursor_screen--;
 		}
 	}
@@ -944,15 +4265,20 @@ static int slash_screen_cursor_back(struct slash *slash, size_t n)
 
 static int slash_screen_cursor_forward(struct slash *slash, size_t n)
 {
+	char esc[24];
+	int len;
+
 	/* If we need to move more than 3 colums, CUF uses fewer bytes */
 	if (n > 3) {
-		slash_printf(slash, ESCAPE("%zuC"), n);
+		len = slash_snprintf(esc, sizeof(esc), ESCAPE("%zuC"), n);
+		if (slash_frame_write(slash, esc, len) < 0)
+			return -1;
 		slash->cursor_screen += n;
 	} else {
-		while (n--) {
-			slash_putchar(slash, slash->buffer[slash->cursor_screen]);
-			slash->cursor_screen++;
-		}
+		if (slash_frame_write(slash,
+				      &slash->buffer[slash->cursor_screen], n) < 0)
+			return -1;
+		slash->cursor_screen += n;
 	}
 
 	return 0;
@@ -973,31 +4299,142 @@ static int slash_screen_cursor_to_column(struct slash *slash, size_t col)
 	return 0;
 }
 
+static size_t slash_screen_escape_cost(size_t n)
+{
+	size_t cost = 4;
+
+	/* ESC, '[', the decimal parameter and the final byte */
+	while (n >= 10) {
+		cost++;
+		n /= 10;
+	}
+
+	return cost;
+}
+
+static size_t slash_screen_move_cost(size_t from, size_t to)
+{
+	size_t n = from > to ? from - to : to - from;
+
+	return n > 3 ? slash_screen_escape_cost(n) : n;
+}
+
+static size_t slash_screen_shift_cost(struct slash *slash)
+{
+	size_t n = slash->shift > 0 ? slash->shift : -slash->shift;
+	size_t length_screen = slash->length_screen + slash->shift;
+	size_t pos = slash->shift_pos, cost;
+
+	/* Move to the shift, insert or delete, write the gap */
+	cost = slash_screen_move_cost(slash->cursor_screen, pos);
+	cost += n > 1 ? slash_screen_escape_cost(n) : 3;
+	if (slash->change_start != slash->change_end) {
+		cost += slash_screen_move_cost(pos, slash->change_start);
+		cost += slash->change_end - slash->change_start;
+		pos = slash->change_end;
+	}
+	if (length_screen > slash->length) {
+		cost += slash_screen_move_cost(pos, slash->length) + 3;
+		pos = slash->length;
+	}
+
+	return cost + slash_screen_move_cost(pos, slash->cursor);
+}
+
+static size_t slash_screen_rewrite_cost(struct slash *slash)
+{
+	size_t start = slash->shift_pos, cost;
+
+	if (slash->change_start != slash->change_end &&
+	    slash->change_start < start)
+		start = slash->change_start;
+
+	/* Move to the first change, write the rest of the line and erase */
+	cost = slash_screen_move_cost(slash->cursor_screen, start);
+	cost += slash->length - start;
+	if (slash->length_screen > slash->length)
+		cost += 3;
+
+	return cost + slash_screen_move_cost(slash->length, slash->cursor);
+}
+
+static int slash_screen_shift(struct slash *slash)
+{
+	size_t n = slash->shift > 0 ? slash->shift : -slash->shift;
+	char esc[24];
+	int len;
+
+	if (slash_screen_cursor_to_column(slash, slash->shift_pos) < 0)
+		return -1;
+
+	/* ICH inserts blanks and DCH deletes characters at the cursor */
+	if (n > 1)
+		len = slash_snprintf(esc, sizeof(esc), ESCAPE("%zu%c"), n,
+			       slash->shift > 0 ? '@' : 'P');
+	else
+		len = slash_snprintf(esc, sizeof(esc), ESCAPE("%c"),
+			       slash->shift > 0 ? '@' : 'P');
+	if (slash_frame_write(slash, esc, len) < 0)
+		return -1;
+
+	slash->length_screen += slash->shift;
+
+	return 0;
+}
+
 int slash_refresh(struct slash *slash)
 {
 	const char *esc = ESCAPE("K");
 
+	/* The output is composed in the frame buffer and written at once */
+	slash->stats.refreshes++;
+
 	/* Full refresh with prompt */
 	if (slash->refresh_full) {
-		slash_putchar(slash, '\r');
-		if (slash_write(slash, esc, strlen(esc)) < 0)
+		if (slash_frame_putchar(slash, '\r') < 0)
+			return -1;
+		if (slash_frame_write(slash, esc, strlen(esc)) < 0)
 			return -1;
-		if (slash_write(slash, slash->prompt, slash->prompt_length) < 0)
+		if (slash_frame_write(slash, slash->prompt,
+				      slash->prompt_length) < 0)
 			return -1;
 		slash->cursor_screen = 0;
 		slash->length_screen = 0;
 		slash->change_start = 0;
 		slash->change_end = slash->length;
+		slash->shift = 0;
 		slash->refresh_full = false;
 	}
 
+	/* The line may have been cut after the changes were marked */
+	if (slash->change_end > slash->length)
+		slash->change_end = slash->length;
+	if (slash->change_start > slash->change_end)
+		slash->change_start = slash->change_end;
+	if (slash->shift_pos > slash->length)
+		slash->shift = 0;
+
+	/* Shift the text on screen for inserted or deleted characters, if
+	 * that costs fewer bytes than rewriting the rest of the line */
+	if (slash->shift) {
+		if (slash_screen_shift_cost(slash) <
+		    slash_screen_rewrite_cost(slash)) {
+			if (slash_screen_shift(slash) < 0)
+				return -1;
+		} else {
+			slash_mark_changed(slash, slash->shift_pos,
+					   slash->length);
+		}
+		slash->shift = 0;
+	}
+
 	/* Buffer contents have changed */
 	if (slash->change_start != slash->change_end) {
 		if (slash_screen_cursor_to_column(slash, slash->change_start) < 0)
 			return -1;
-		if (slash_write(slash,
-				&slash->buffer[slash->change_start],
-				slash->change_end - slash->change_start) < 0)
+		if (slash_frame_write(slash,
+				      &slash->buffer[slash->change_start],
+				      slash->change_end - slash->change_start) < 0)
 			return -1;
 		slash->cursor_screen = slash->change_end;
 		slash->change_start = slash->change_end = 0;
@@ -1007,7 +4444,7 @@ int slash_refresh(struct slash *slash)
 	if (slash->length_screen > slash->length) {
 		if (slash_screen_cursor_to_column(slash, slash->length) < 0)
 			return -1;
-		if (slash_write(slash, esc, strlen(esc)) < 0)
+		if (slash_frame_write(slash, esc, strlen(esc)) < 0)
 			return -1;
 	}
 	slash->length_screen = slash->length;
@@ -1016,6 +4453,9 @@ int slash_refresh(struct slash *slash)
 	if (slash_screen_cursor_to_column(slash, slash->cursor) < 0)
 		return -1;
 
+	if (slash_frame_emit(slash) < 0)
+		return -1;
+
 	return slash_write_flush(slash);
 }
 
@@ -1030,7 +4470,7 @@ static void slash_insert(struct slash *slash, int c)
 		slash->length - slash->cursor);
 	slash->buffer[slash->cursor] = c;
 	slash->length++;
-	slash_mark_changed(slash, slash->cursor, slash->length);
+	slash_mark_inserted(slash, slash->cursor, 1);
 	slash->cursor++;
 	slash->buffer[slash->length] = '\0';
 }
@@ -1044,7 +4484,7 @@ static void slash_delete(struct slash *slash)
 	memmove(&slash->buffer[slash->cursor],
 		&slash->buffer[slash->cursor + 1],
 		slash->length - slash->cursor);
-	slash_mark_changed(slash, slash->cursor, slash->length);
+	slash_mark_deleted(slash, slash->cursor, 1);
 	slash->buffer[slash->length] = '\0';
 }
 
@@ -1099,7 +4539,7 @@ static void slash_backspace(struct slash *slash)
 	memmove(&slash->buffer[slash->cursor],
 		&slash->buffer[slash->cursor + 1],
 		slash->length - slash->cursor);
-	slash_mark_changed(slash, slash->cursor, slash->length);
+	slash_mark_deleted(slash, slash->cursor, 1);
 	slash->buffer[slash->length] = '\0';
 }
 
@@ -1116,7 +4556,7 @@ static void slash_delete_word(struct slash *slash)
 	memmove(&slash->buffer[slash->cursor],
 		&slash->buffer[old_cursor],
 		slash->length - slash->cursor);
-	slash_mark_changed(slash, slash->cursor, slash->length);
+	slash_mark_deleted(slash, slash->cursor, old_cursor - slash->cursor);
 	slash->buffer[slash->length] = '\0';
 }
 
@@ -1133,6 +4573,139 @@ static void slash_swap(struct slash *slash)
 	}
 }
 
+/* Bracketed paste */
+void slash_set_paste_memory(struct slash *slash, char *buffer, size_t size)
+{
+	if (slash->paste_alloc) {
+		free(slash->paste);
+		slash->paste_alloc = false;
+	}
+
+	slash->paste = buffer;
+	slash->paste_size = size;
+	slash->paste_pos = 0;
+	slash->paste_len = 0;
+}
+
+static bool slash_paste_end(struct slash *slash)
+{
+	const char *end = "[201~";
+	size_t i = 0;
+	int c;
+
+	/* Match the rest of ESC[201~, a new ESC restarts the match */
+	while (end[i]) {
+		c = slash_getchar(slash);
+		if (c < 0)
+			return true;
+		if (c == end[i])
+			i++;
+		else if (c == ESC)
+			i = 0;
+		else
+			return false;
+	}
+
+	return true;
+}
+
+static bool slash_paste(struct slash *slash)
+{
+	size_t tail = slash->length - slash->cursor;
+	size_t gap = slash->line_size - 1 - tail;
+	size_t start = slash->cursor;
+	bool newline = false, truncated = false, overflow = false, cr = false;
+	int c;
+
+	/* Move the text after the cursor to the end of the line buffer, so
+	 * the first pasted line can be stored directly at the cursor */
+	memmove(&slash->buffer[gap], &slash->buffer[slash->cursor], tail);
+
+	while ((c = slash_getchar(slash)) >= 0) {
+		if (c == ESC) {
+			if (slash_paste_end(slash))
+				break;
+			continue;
+		}
+
+		/* Accept CR, LF and CRLF line endings. Tabs are inserted as
+		 * spaces, so they do not trigger completion, and other
+		 * control characters are dropped */
+		if (c == '\n' && cr) {
+			cr = false;
+			continue;
+		}
+		cr = (c == '\r');
+		if (c == '\r')
+			c = '\n';
+		else if (c == '\t')
+			c = ' ';
+		else if (c != '\n' && !isprint(c))
+			continue;
+
+		if (!newline) {
+			if (c == '\n')
+				newline = true;
+			else if (slash->cursor < gap)
+				slash->buffer[slash->cursor++] = c;
+			else
+				truncated = true;
+		} else if (slash->paste_len < slash->paste_size) {
+			/* Queue the following lines */
+			slash->paste[slash->paste_len++] = c;
+		} else {
+			overflow = true;
+		}
+	}
+
+	/* Close the gap */
+	memmove(&slash->buffer[slash->cursor], &slash->buffer[gap], tail);
+	slash->length = slash->cursor + tail;
+	slash->buffer[slash->length] = '\0';
+	slash_mark_inserted(slash, start, slash->cursor - start);
+
+	/* Never execute a line that was cut short. If the first line did
+	 * not fit, leave it for editing and drop the rest of the paste */
+	if (truncated) {
+		slash->paste_len = slash->paste_pos;
+		newline = false;
+	} else if (overflow) {
+		while (slash->paste_len > slash->paste_pos &&
+		       slash->paste[slash->paste_len - 1] != '\n')
+			slash->paste_len--;
+	}
+	if (truncated || overflow)
+		slash_bell(slash);
+
+	return newline;
+}
+
+static bool slash_paste_next(struct slash *slash)
+{
+	bool newline = false;
+	char c;
+
+	while (slash->paste_pos < slash->paste_len) {
+		c = slash->paste[slash->paste_pos++];
+		if (c == '\n') {
+			newline = true;
+			break;
+		}
+		if (slash->length + 1 < slash->line_size)
+			slash->buffer[slash->length++] = c;
+	}
+
+	if (slash->paste_pos == slash->paste_len) {
+		slash->paste_pos = 0;
+		slash->paste_len = 0;
+	}
+
+	slash->buffer[slash->length] = '\0';
+	slash->cursor = slash->length;
+
+	return newline;
+}
+
 void slash_set_prompt(struct slash *slash, const char *prompt)
 {
 	slash->prompt = prompt;
@@ -1142,11 +4715,14 @@ void slash_set_prompt(struct slash *slash, const char *prompt)
 char *slash_readline(struct slash *slash)
 {
 	char *ret = slash->buffer;
-	int c, esc[3];
+	int c, esc[5];
 	bool done = false, escaped = false;
 
 	/* Reset buffer */
 	slash_reset(slash);
+
+	/* Lines queued by a multi-line paste are returned one at a time */
+	done = slash_paste_next(slash);
 	slash_refresh(slash);
 
 	while (!done && ((c = slash_getchar(slash)) >= 0)) {
@@ -1165,8 +4741,15 @@ char *slash_readline(struct slash *slash)
 			} else if (esc[0] == '[' && (esc[1] > '0' &&
 						     esc[1] < '7')) {
 				esc[2] = slash_getchar(slash);
-				if (esc[1] == '3' && esc[2] == '~')
+				if (esc[1] == '3' && esc[2] == '~') {
 					slash_delete(slash);
+				} else if (esc[1] == '2' && esc[2] == '0') {
+					/* Bracketed paste starts with ESC[200~ */
+					esc[3] = slash_getchar(slash);
+					esc[4] = slash_getchar(slash);
+					if (esc[3] == '0' && esc[4] == '~')
+						done = slash_paste(slash);
+				}
 			} else if (esc[0] == 'O' && esc[1] == 'H') {
 				slash->cursor = 0;
 			} else if (esc[0] == 'O' && esc[1] == 'F') {
@@ -1233,6 +4816,8 @@ char *slash_readline(struct slash *slash)
 				slash_delete_word(slash);
 				break;
 			case '\t':
+				/* Completion may list candidates below the line */
+				slash_refresh(slash);
 				slash_complete(slash);
 				break;
 			case '\r':
@@ -1255,7 +4840,10 @@ char *slash_readline(struct slash *slash)
 			slash_insert(slash, c);
 		}
 
-		slash_refresh(slash);
+		/* Apply all available input before rendering the result, so a
+		 * paste or a held key only refreshes the line once per read */
+		if (done || !slash_input_pending(slash))
+			slash_refresh(slash);
 
 		slash->last_char = c;
 	}
@@ -1266,42 +4854,259 @@ char *slash_readline(struct slash *slash)
 	return ret;
 }
 
+/* Keyword search */
+#define slash_keyword_char(c) (isalnum((unsigned char)(c)) || (c) == '_')
+
+/* Hash next word of text, returning false at the end of text */
+static bool slash_keyword_next(struct slash_text *text, uint32_t *hash)
+{
+	int c;
+
+	while ((c = slash_text_getc(text)) && !slash_keyword_char(c))
+		;
+	if (!c)
+		return false;
+
+	/* FNV-1a over lower case characters */
+	*hash = 2166136261u;
+	do {
+		*hash ^= tolower(c);
+		*hash *= 16777619u;
+	} while ((c = slash_text_getc(text)) && slash_keyword_char(c));
+
+	return true;
+}
+
+static uint32_t slash_keyword_hash(const char *word)
+{
+	struct slash_text text;
+	uint32_t hash = 0;
+
+	slash_text_init(&text, word, false);
+	slash_keyword_next(&text, &hash);
+
+	return hash;
+}
+
+static int slash_keyword_cmp(const void *a, const void *b)
+{
+	const struct slash_keyword *ka = a, *kb = b;
+
+	if (ka->hash != kb->hash)
+		return ka->hash < kb->hash ? -1 : 1;
+
+	return (int)ka->node - (int)kb->node;
+}
+
+/* Add words of text to keywords, or just count them if keywords is NULL */
+static size_t slash_keyword_add(struct slash_keyword *keywords,
+				struct slash_text *text, uint16_t node)
+{
+	uint32_t hash;
+	size_t count = 0;
+
+	while (slash_keyword_next(text, &hash)) {
+		if (keywords) {
+			keywords[count].hash = hash;
+			keywords[count].node = node;
+		}
+		count++;
+	}
+
+	return count;
+}
+
+static size_t slash_keyword_add_command(struct slash_keyword *keywords,
+					const struct slash_command *cmd,
+					uint16_t node)
+{
+	struct slash_text text;
+	size_t count;
+
+	slash_text_init(&text, cmd->name, false);
+	count = slash_keyword_add(keywords, &text, node);
+	slash_text_init(&text, cmd->args, false);
+	count += slash_keyword_add(keywords ? &keywords[count] : NULL, &text, node);
+	slash_text_help(&text, cmd);
+	count += slash_keyword_add(keywords ? &keywords[count] : NULL, &text, node);
+
+	return count;
+}
+
+static int slash_keyword_build(void)
+{
+	struct slash_keyword *keywords;
+	size_t i, j, count = 0;
+
+	if (slash_keywords && slash_keyword_generation == slash_index_generation)
+		return 0;
+
+	for (i = 1; i < slash_node_count; i++)
+		count += slash_keyword_add_command(NULL, slash_nodes[i].command, i);
+
+	keywords = malloc((count ? count : 1) * sizeof(*keywords));
+	if (!keywords)
+		return -ENOMEM;
+
+	count = 0;
+	for (i = 1; i < slash_node_count; i++)
+		count += slash_keyword_add_command(&keywords[count],
+						   slash_nodes[i].command, i);
+
+	qsort(keywords, count, sizeof(*keywords), slash_keyword_cmp);
+
+	/* Remove duplicate words of the same command */
+	for (i = 0, j = 0; i < count; i++)
+		if (!j || slash_keyword_cmp(&keywords[j - 1], &keywords[i]))
+			keywords[j++] = keywords[i];
+
+	free(slash_keywords);
+	slash_keywords = keywords;
+	slash_keyword_count = j;
+	slash_keyword_generation = slash_index_generation;
+
+	return 0;
+}
+
+static bool slash_keyword_in_text(struct slash_text *text, const char *keyword)
+{
+	size_t i, len = strlen(keyword);
+	bool match;
+	int c;
+
+	while (1) {
+		while ((c = slash_text_getc(text)) && !slash_keyword_char(c))
+			;
+		if (!c)
+			return false;
+
+		/* Compare word to keyword while reading it */
+		i = 0;
+		match = true;
+		do {
+			if (i >= len || tolower(c) != tolower((unsigned char)keyword[i]))
+				match = false;
+			i++;
+		} while ((c = slash_text_getc(text)) && slash_keyword_char(c));
+
+		if (match && i == len)
+			return true;
+		if (!c)
+			return false;
+	}
+}
+
+/* Check the text itself, as different words can have the same hash */
+static bool slash_keyword_in_command(const struct slash_command *cmd,
+				     const char *keyword)
+{
+	struct slash_text text;
+
+	slash_text_init(&text, cmd->name, false);
+	if (slash_keyword_in_text(&text, keyword))
+		return true;
+
+	slash_text_init(&text, cmd->args, false);
+	if (slash_keyword_in_text(&text, keyword))
+		return true;
+
+	slash_text_help(&text, cmd);
+	return slash_keyword_in_text(&text, keyword);
+}
+
 /* Builtin commands */
 static int slash_builtin_help(struct slash *slash)
 {
+	const struct slash_node *cur, *node = slash_node_root();
+	const struct slash_span *span;
+	bool ambiguous;
 	int i;
-	char *args;
-	struct slash_command *cur;
 
 	/* If no arguments given, just list all top-level commands */
 	if (slash->argc < 2) {
 		slash_printf(slash, "Available commands:\n");
-		slash_command_list_for_each(cur) {
-			if (cur->parent)
-				continue;
-			if (slash_command_is_hidden(slash, cur))
-				continue;
-			slash_command_description(slash, cur);
-		}
+		slash_node_for_each_visible_child(slash, cur, slash_node_root())
+			slash_command_description(slash, cur->command);
 		return SLASH_SUCCESS;
 	}
 
-	/* Unbuild args */
-	for (i = 2; i < slash->argc; i++)
-		*(slash->argv[i] - 1) = ' ';
-
-	cur = slash_command_find(slash, slash->argv[1], strlen(slash->argv[1]), &args);
-	if (!cur) {
-		slash_printf(slash, "No such command: %s\n", slash->argv[1]);
-		return SLASH_EINVAL;
+	/* Each argument is a word of the command path, which may have been
+	 * quoted or expanded from a variable */
+	for (i = 1; i < slash->argc; i++) {
+		span = &slash->spans[i];
+		node = slash_command_step(slash, node, span->str, span->len,
+					  &ambiguous);
+		if (!node) {
+			slash_printf(slash, "No such command: %.*s\n",
+				     (int)span->len, span->str);
+			return SLASH_EINVAL;
+		}
 	}
 
-	slash_command_help(slash, cur);
+	slash_command_help(slash, node);
 
 	return SLASH_SUCCESS;
 }
 slash_command(help, slash_builtin_help, "[command]",
-	      "Show available commands");
+	      "Show available commands", SLASH_FLAG_SPANS);
+
+static int slash_builtin_apropos(struct slash *slash)
+{
+	const struct slash_keyword *keyword;
+	struct slash_command *cmd;
+	struct slash_text help;
+	size_t low, high, mid;
+	uint32_t hash;
+	int i, matches = 0;
+
+	if (slash->argc < 2)
+		return SLASH_EUSAGE;
+
+	if (slash_keyword_build() < 0)
+		return SLASH_ENOMEM;
+
+	/* Find first entry of the first word and check the other words */
+	hash = slash_keyword_hash(slash->argv[1]);
+	low = 0;
+	high = slash_keyword_count;
+	while (low < high) {
+		mid = low + (high - low) / 2;
+		if (slash_keywords[mid].hash < hash)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	for (keyword = &slash_keywords[low];
+	     keyword < &slash_keywords[slash_keyword_count] &&
+	     keyword->hash == hash; keyword++) {
+		if (slash_node_is_hidden(slash, &slash_nodes[keyword->node]))
+			continue;
+
+		cmd = slash_nodes[keyword->node].command;
+		for (i = 1; i < slash->argc; i++)
+			if (!slash_keyword_in_command(cmd, slash->argv[i]))
+				break;
+		if (i < slash->argc)
+			continue;
+
+		slash_command_name_recurse(slash, cmd);
+		slash_printf(slash, " - ");
+		slash_text_help(&help, cmd);
+		slash_text_print(slash, &help, true);
+		slash_printf(slash, "\n");
+		matches++;
+	}
+
+	if (!matches) {
+		slash_printf(slash, "Nothing appropriate\n");
+		return SLASH_ENOENT;
+	}
+
+	return SLASH_SUCCESS;
+}
+slash_command(apropos, slash_builtin_apropos, "<keyword> [keyword...]",
+	      "Search command names and help for keywords");
 
 static int slash_builtin_history(struct slash *slash)
 {
@@ -1322,7 +5127,8 @@ static int slash_builtin_echo(struct slash *slash)
 	int i;
 
 	for (i = 1; i < slash->argc; i++) {
-		slash_printf(slash, "%s", slash->argv[i]);
+		slash_printf(slash, "%.*s",
+			     (int)slash->spans[i].len, slash->spans[i].str);
 		if (i + 1 < slash->argc)
 			slash_printf(slash, " ");
 	}
@@ -1332,7 +5138,50 @@ static int slash_builtin_echo(struct slash *slash)
 	return SLASH_SUCCESS;
 }
 slash_command(echo, slash_builtin_echo, "[string]",
-	      "Display a line of text");
+	      "Display a line of text", SLASH_FLAG_SPANS);
+
+static int slash_builtin_set(struct slash *slash)
+{
+	const char *var;
+	int ret;
+
+	if (slash->argc == 1) {
+		slash_var_for_each(slash, var)
+			slash_printf(slash, "%s=%s\n",
+				     slash_var_name(var), slash_var_value(var));
+		return SLASH_SUCCESS;
+	}
+
+	if (slash->argc != 3)
+		return SLASH_EUSAGE;
+
+	ret = slash_set_variable(slash, slash->argv[1], slash->argv[2]);
+	if (ret == -EINVAL)
+		slash_printf(slash, "Invalid variable name: %s\n", slash->argv[1]);
+	else if (ret == -E2BIG)
+		slash_printf(slash, "Variable too long\n");
+	else if (ret == -ENOSPC)
+		slash_printf(slash, "Not enough memory for variable\n");
+
+	return ret < 0 ? SLASH_EINVAL : SLASH_SUCCESS;
+}
+slash_command(set, slash_builtin_set, "[name value]",
+	      "Set variable, or list variables");
+
+static int slash_builtin_unset(struct slash *slash)
+{
+	if (slash->argc != 2)
+		return SLASH_EUSAGE;
+
+	if (slash_set_variable(slash, slash->argv[1], NULL) < 0) {
+		slash_printf(slash, "No such variable: %s\n", slash->argv[1]);
+		return SLASH_ENOENT;
+	}
+
+	return SLASH_SUCCESS;
+}
+slash_command(unset, slash_builtin_unset, "<name>",
+	      "Remove variable");
 
 #ifndef SLASH_NO_EXIT
 static int slash_builtin_exit(struct slash *slash)
@@ -1387,19 +5236,29 @@ int slash_loop(struct slash *slash)
 
 int slash_init(struct slash *slash,
 	       char *line, size_t line_size,
-	       char *history, size_t history_size)
+	       char *history, size_t history_size,
+	       char *args, size_t args_size)
 {
+	int ret;
+
+	/* Build command index on first use */
+	if (!slash_nodes || slash_index_dirty) {
+		ret = slash_index_build();
+		if (ret < 0)
+			return ret;
+	}
+
 	/* Ensure context and buffers are zero */
 	memset(slash, 0, sizeof(*slash));
 	memset(line, 0, line_size);
 	memset(history, 0, history_size);
 
 	/* Setup default values */
+	slash->io = &slash_io_stdio;
 	slash->file_read = stdin;
 	slash->file_write = stdout;
-#ifdef SLASH_HAVE_SELECT
-	slash->waitfunc = slash_wait_select;
-#endif
+	slash->fd_read = STDIN_FILENO;
+	slash->fd_write = STDOUT_FILENO;
 
 	/* Set default prompt */
 	slash_set_prompt(slash, "slash> ");
@@ -1416,28 +5275,46 @@ int slash_init(struct slash *slash,
 	slash->history_cursor = slash->history;
 	slash->history_avail = slash->history_size - 1;
 
+	/* Initialize argument memory */
+	slash_args_set(slash, args, args_size);
+
 	return 0;
 }
 
 struct slash *slash_create(size_t line_size, size_t history_size)
 {
 	struct slash *slash = NULL;
-	char *line = NULL, *history = NULL;
+	char *line = NULL, *history = NULL, *args = NULL, *vars = NULL;
+	char *paste = NULL;
 
 	/* Allocate slash context and buffers */
 	slash = malloc(sizeof(*slash));
 	line = malloc(line_size);
 	history = malloc(history_size);
-
-	if (slash && line && history) {
-		if (!slash_init(slash, line, line_size, history, history_size))
+	args = malloc(SLASH_ARGS_SIZE);
+	vars = malloc(SLASH_VARS_SIZE);
+	paste = malloc(SLASH_PASTE_SIZE);
+
+	if (slash && line && history && args && vars && paste) {
+		if (!slash_init(slash, line, line_size, history, history_size,
+				args, SLASH_ARGS_SIZE)) {
+			/* Argument memory grows as needed */
+			slash->args_grow = true;
+			slash_set_variable_memory(slash, vars, SLASH_VARS_SIZE);
+			slash->vars_alloc = true;
+			slash_set_paste_memory(slash, paste, SLASH_PASTE_SIZE);
+			slash->paste_alloc = true;
 			return slash;
+		}
 	}
 
 	/* Allocation or initialization error */
 	free(slash);
 	free(line);
 	free(history);
+	free(args);
+	free(vars);
+	free(paste);
 
 	return NULL;
 }
@@ -1452,6 +5329,20 @@ void slash_destroy(struct slash *slash)
 		free(slash->history);
 		slash->history = NULL;
 	}
+	if (slash->args_mem) {
+		free(slash->args_mem);
+		slash->args_mem = NULL;
+	}
+	if (slash->vars_alloc) {
+		free(slash->vars);
+		slash->vars = NULL;
+		slash->vars_alloc = false;
+	}
+	if (slash->paste_alloc) {
+		free(slash->paste);
+		slash->paste = NULL;
+		slash->paste_alloc = false;
+	}
 
 	free(slash);
 }
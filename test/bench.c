@@ -0,0 +1,194 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014-2023 Satlab A/S <satlab@satlab.com>
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/* Microbenchmark of command line scanning, of command dispatch and of the
+ * built-in formatter. Build with -DSLASH_NO_SIMD to compare with the scalar
+ * scanning implementation. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <slash/slash.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_UNIT	"cycle"
+#define bench_time()	__rdtsc()
+#else
+#define BENCH_UNIT	"ns"
+static unsigned long long bench_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+#endif
+
+#define LINE_SIZE	128
+#define HISTORY_SIZE	128
+#define PAYLOAD_SIZE	4096
+#define ITERATIONS	10000
+#define CALLS		1000000
+
+static int cmd_payload(struct slash *slash)
+{
+	return slash->argc == 2 ? SLASH_SUCCESS : SLASH_EUSAGE;
+}
+slash_command(payload, cmd_payload, "<data>", "Accept payload",
+	      SLASH_FLAG_SPANS);
+
+static int cmd_reg_write(struct slash *slash)
+{
+	return slash->argc == 3 ? SLASH_SUCCESS : SLASH_EUSAGE;
+}
+slash_command_group(reg, "Registers");
+slash_command_sub(reg, write, cmd_reg_write, "<addr> <value>",
+		  "Write register");
+
+static double bench_seconds(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench_calls(struct slash *slash)
+{
+	static const char line[] = "reg write 0x10 0xff";
+	static char *argv[] = {"reg", "write", "0x10", "0xff"};
+	struct slash_prepared prepared;
+	double start, stop;
+	int i;
+
+	if (slash_prepare(slash, &prepared, line) < 0) {
+		fprintf(stderr, "prepare: command failed\n");
+		exit(EXIT_FAILURE);
+	}
+
+	start = bench_seconds();
+	for (i = 0; i < CALLS; i++)
+		slash_execute(slash, line);
+	stop = bench_seconds();
+	printf("%-12s %8.2f Mcalls/s\n", "execute", CALLS / (stop - start) / 1e6);
+
+	start = bench_seconds();
+	for (i = 0; i < CALLS; i++)
+		slash_execute_argv(slash, 4, argv);
+	stop = bench_seconds();
+	printf("%-12s %8.2f Mcalls/s\n", "argv", CALLS / (stop - start) / 1e6);
+
+	start = bench_seconds();
+	for (i = 0; i < CALLS; i++)
+		slash_run(slash, &prepared);
+	stop = bench_seconds();
+	printf("%-12s %8.2f Mcalls/s\n", "prepared", CALLS / (stop - start) / 1e6);
+}
+
+static void bench_format(void)
+{
+	static const char *names[] = {"help", "history", "watch"};
+	char buf[64];
+	double start, stop;
+	int i;
+
+	start = bench_seconds();
+	for (i = 0; i < CALLS; i++)
+		slash_snprintf(buf, sizeof(buf), "%-15s %s %zu\n",
+			       names[i % 3], "Show help", (size_t)i);
+	stop = bench_seconds();
+	printf("%-12s %8.2f Mcalls/s\n", "slash_fmt", CALLS / (stop - start) / 1e6);
+
+	start = bench_seconds();
+	for (i = 0; i < CALLS; i++)
+		snprintf(buf, sizeof(buf), "%-15s %s %zu\n",
+			 names[i % 3], "Show help", (size_t)i);
+	stop = bench_seconds();
+	printf("%-12s %8.2f Mcalls/s\n", "libc_fmt", CALLS / (stop - start) / 1e6);
+}
+
+static void bench(struct slash *slash, const char *name, const char *line)
+{
+	unsigned long long start, stop;
+	size_t len = strlen(line);
+	int i;
+
+	if (slash_execute(slash, line) != SLASH_SUCCESS) {
+		fprintf(stderr, "%s: command failed\n", name);
+		exit(EXIT_FAILURE);
+	}
+
+	start = bench_time();
+	for (i = 0; i < ITERATIONS; i++)
+		slash_execute(slash, line);
+	stop = bench_time();
+
+	printf("%-12s %8.2f bytes/%s\n", name,
+	       (double)len * ITERATIONS / (stop - start), BENCH_UNIT);
+}
+
+int main(void)
+{
+	struct slash *slash;
+	char *line;
+
+	slash = slash_create(LINE_SIZE, HISTORY_SIZE);
+	line = malloc(PAYLOAD_SIZE + 32);
+	if (!slash || !line) {
+		fprintf(stderr, "Failed to init slash\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/* Long unquoted argument, such as a hex payload */
+	strcpy(line, "payload ");
+	memset(&line[8], 'a', PAYLOAD_SIZE);
+	line[PAYLOAD_SIZE + 8] = '\0';
+	bench(slash, "unquoted", line);
+
+	/* Long quoted argument with spaces */
+	strcpy(line, "payload \"");
+	memset(&line[9], ' ', PAYLOAD_SIZE);
+	strcpy(&line[PAYLOAD_SIZE + 9], "\"");
+	bench(slash, "quoted", line);
+
+	/* Long run of separators */
+	memset(line, ' ', PAYLOAD_SIZE);
+	strcpy(&line[PAYLOAD_SIZE], "payload data");
+	bench(slash, "separators", line);
+
+	/* Short command executed many times */
+	bench_calls(slash);
+
+	/* Formatting of a help line */
+	bench_format();
+
+	free(line);
+	slash_destroy(slash);
+
+	return 0;
+}
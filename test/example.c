@@ -99,6 +99,7 @@ int main(int argc, char **argv)
 	}
 
 	slash_set_prompt(slash, prompt);
+	slash_set_abbreviate(slash, true);
 	slash_loop(slash);
 	slash_destroy(slash);
 
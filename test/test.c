@@ -28,6 +28,8 @@
 #include <setjmp.h>
 #include <cmocka.h>
 
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <slash/slash.h>
@@ -72,6 +74,7 @@ static int cmd_test_subsub(struct slash *slash)
 	return SLASH_SUCCESS;
 }
 slash_command_subsub(test, sub, subsub, cmd_test_subsub, NULL, NULL);
+slash_command_sub_alias(test, s, slash_cmd_test_sub);
 
 static int cmd_test_subsubsub(struct slash *slash)
 {
@@ -88,6 +91,7 @@ slash_command_subgroup(group, subgroup, NULL);
 slash_command_subsubgroup(group, subgroup, subsubgroup, NULL);
 slash_command_subsubsub(group, subgroup, subsubgroup, subsubsub,
 			cmd_test_subsubsub, NULL, NULL);
+slash_command_subgroup(group, subset, NULL);
 
 static int cmd_privileged(struct slash *slash)
 {
@@ -95,6 +99,12 @@ static int cmd_privileged(struct slash *slash)
 }
 slash_command(privileged, cmd_privileged, NULL, NULL,
 	      SLASH_FLAG_PRIVILEGED);
+slash_command(developer, cmd_privileged, NULL, NULL,
+	      SLASH_FLAG_LEVEL(SLASH_LEVEL_DEVELOPER));
+
+slash_command_group(secret, NULL, SLASH_FLAG_PRIVILEGED);
+slash_command_sub(secret, reboot, cmd_privileged, NULL, NULL);
+slash_command_alias(rb, slash_cmd_secret_reboot);
 
 static int cmd_context(struct slash *slash)
 {
@@ -106,6 +116,158 @@ static int cmd_context(struct slash *slash)
 slash_command(context, cmd_context, NULL, NULL,
 	      0, (void *)123);
 
+struct schema_args {
+	long count;
+	int mode;
+	char *name;
+};
+
+static const char *const schema_modes[] = {"on", "off", NULL};
+
+slash_schema(schema_test, struct schema_args, 2,
+	SLASH_ARG_INT(struct schema_args, count, "count", 1, 10),
+	SLASH_ARG_ENUM(struct schema_args, mode, "mode", schema_modes),
+	SLASH_ARG_STRING(struct schema_args, name, "name"));
+
+static int cmd_schema(struct slash *slash)
+{
+	struct schema_args *args = slash->params;
+
+	if (args->count != 3 || args->mode != 1)
+		return SLASH_EINVAL;
+
+	if (slash->argc == 4 && strcmp(args->name, "abc"))
+		return SLASH_EINVAL;
+
+	if (slash->argc == 3 && args->name != NULL)
+		return SLASH_EINVAL;
+
+	return SLASH_SUCCESS;
+}
+slash_command(schema, cmd_schema, &schema_test, NULL);
+
+slash_options(options_test,
+	{"verbose", 'v', SLASH_OPT_NONE},
+	{"count", 'c', SLASH_OPT_REQUIRED},
+	{"color", 256, SLASH_OPT_OPTIONAL},
+	{NULL, 'x', SLASH_OPT_NONE});
+
+static int cmd_options(struct slash *slash)
+{
+	int c, verbose = 0, color = 0, x = 0;
+	const char *count = NULL;
+
+	while ((c = slash_getopt_long(slash, &options_test, NULL)) != -1) {
+		switch (c) {
+		case 'v':
+			verbose++;
+			break;
+		case 'c':
+			count = slash->optarg;
+			break;
+		case 256:
+			color = slash->optarg ? atoi(slash->optarg) : 1;
+			break;
+		case 'x':
+			x++;
+			break;
+		default:
+			return SLASH_EUSAGE;
+		}
+	}
+
+	if (verbose != 2 || x != 1 || !count || strcmp(count, "3") ||
+	    color != 2 || slash->optind != slash->argc - 1 ||
+	    strcmp(slash->argv[slash->optind], "arg"))
+		return SLASH_EINVAL;
+
+	return SLASH_SUCCESS;
+}
+slash_command(options, cmd_options, "[options] arg", NULL);
+
+static int cmd_variable(struct slash *slash)
+{
+	/* Variables used as whole arguments are not copied */
+	if (slash->argc != 2 ||
+	    slash->argv[1] != slash_get_variable(slash, "a"))
+		return SLASH_EINVAL;
+
+	return SLASH_SUCCESS;
+}
+slash_command(variable, cmd_variable, "<$a>", NULL);
+
+static int cmd_bulk(struct slash *slash)
+{
+	int i;
+
+	if (slash->argc != 65)
+		return SLASH_EUSAGE;
+
+	for (i = 1; i < slash->argc; i++)
+		if (strtol(slash->argv[i], NULL, 0) != i)
+			return SLASH_EINVAL;
+
+	if (slash->argv[slash->argc] != NULL)
+		return SLASH_EINVAL;
+
+	return SLASH_SUCCESS;
+}
+slash_command(bulk, cmd_bulk, "<value>...", NULL);
+
+static int cmd_leave(struct slash *slash)
+{
+	return SLASH_EXIT;
+}
+slash_command(leave, cmd_leave, NULL, NULL);
+
+struct memory_io {
+	const char *input;
+	size_t input_len;
+	size_t chunk;
+	unsigned int reads;
+	unsigned int writes;
+	char output[256];
+	size_t output_len;
+};
+
+static int memory_read(struct slash *slash, void *buf, size_t count)
+{
+	struct memory_io *mem = slash->io_arg;
+
+	if (!mem->input_len)
+		return -EIO;
+
+	if (count > mem->input_len)
+		count = mem->input_len;
+	if (mem->chunk && count > mem->chunk)
+		count = mem->chunk;
+	memcpy(buf, mem->input, count);
+	mem->input += count;
+	mem->input_len -= count;
+	mem->reads++;
+
+	return count;
+}
+
+static int memory_write(struct slash *slash, const void *buf, size_t count)
+{
+	struct memory_io *mem = slash->io_arg;
+
+	if (count > sizeof(mem->output) - 1 - mem->output_len)
+		return -ENOSPC;
+	memcpy(&mem->output[mem->output_len], buf, count);
+	mem->output_len += count;
+	mem->writes++;
+	mem->output[mem->output_len] = '\0';
+
+	return count;
+}
+
+static const struct slash_io memory_io = {
+	.read = memory_read,
+	.write = memory_write,
+};
+
 static void slash_test_command(void **state)
 {
 	struct slash *slash = *state;
@@ -161,6 +323,143 @@ static void slash_test_subsubsub_command_in_group(void **state)
 	assert_int_equal(ret, 0);
 }
 
+static void slash_test_group_command(void **state)
+{
+	struct slash *slash = *state;
+
+	int ret;
+	char *cmd = "group subgroup";
+
+	ret = slash_execute(slash, cmd);
+	assert_int_equal(ret, -EISDIR);
+}
+
+static void slash_test_unknown_subcommand(void **state)
+{
+	struct slash *slash = *state;
+
+	int ret;
+	char *cmd = "group subgroup nosuchcommand";
+
+	ret = slash_execute(slash, cmd);
+	assert_int_equal(ret, -EISDIR);
+}
+
+static void slash_test_register_command(void **state)
+{
+	struct slash *slash = *state;
+
+	int ret;
+	struct slash_command group = {
+		.name = "dynamic",
+	};
+	struct slash_command sub = {
+		.name = "sub",
+		.func = cmd_test_sub,
+		.parent = &group,
+	};
+	struct slash_command orphan = {
+		.name = "orphan",
+		.func = cmd_test_sub,
+		.parent = &sub,
+	};
+	struct slash_command twin = {
+		.name = "sub",
+		.func = cmd_test_sub,
+		.parent = &group,
+	};
+	struct slash_command builtin = {
+		.name = "test",
+		.func = cmd_test_sub,
+	};
+
+	ret = slash_command_register(&group);
+	assert_int_equal(ret, 0);
+	ret = slash_command_register(&group);
+	assert_int_equal(ret, -EEXIST);
+	ret = slash_command_register(&sub);
+	assert_int_equal(ret, 0);
+
+	/* Names are unique under the same parent */
+	ret = slash_command_register(&twin);
+	assert_int_equal(ret, -EEXIST);
+	ret = slash_command_register(&builtin);
+	assert_int_equal(ret, -EEXIST);
+
+	ret = slash_execute(slash, "dynamic sub");
+	assert_int_equal(ret, 0);
+
+	/* Parent must be registered first */
+	ret = slash_command_unregister(&sub);
+	assert_int_equal(ret, 0);
+	ret = slash_command_register(&orphan);
+	assert_int_equal(ret, -EINVAL);
+
+	/* Children must be unregistered first */
+	ret = slash_command_register(&sub);
+	assert_int_equal(ret, 0);
+	ret = slash_command_unregister(&group);
+	assert_int_equal(ret, -EBUSY);
+	ret = slash_command_unregister(&sub);
+	assert_int_equal(ret, 0);
+	ret = slash_command_unregister(&group);
+	assert_int_equal(ret, 0);
+
+	ret = slash_execute(slash, "dynamic sub");
+	assert_int_equal(ret, -ENOENT);
+}
+
+static void slash_test_register_subcommand(void **state)
+{
+	struct slash *slash = *state;
+
+	int ret;
+	struct slash_command sub = {
+		.name = "dynamic",
+		.func = cmd_test_sub,
+		.parent = &slash_cmd_group_subgroup,
+	};
+
+	ret = slash_command_register(&sub);
+	assert_int_equal(ret, 0);
+
+	ret = slash_execute(slash, "group subgroup dynamic");
+	assert_int_equal(ret, 0);
+
+	/* Static commands are still found */
+	ret = slash_execute(slash, "group subgroup subsubgroup subsubsub");
+	assert_int_equal(ret, 0);
+
+	ret = slash_command_unregister(&sub);
+	assert_int_equal(ret, 0);
+}
+
+static bool filter_no_test(const struct slash_command *command, void *arg)
+{
+	return strcmp(command->name, arg) != 0;
+}
+
+static void slash_test_view(void **state)
+{
+	struct slash *slash = *state;
+
+	int ret;
+	struct slash_view view;
+
+	ret = slash_view_init(&view, filter_no_test, "subsub");
+	assert_int_equal(ret, 0);
+	slash_set_view(slash, &view);
+
+	ret = slash_execute(slash, "test sub");
+	assert_int_equal(ret, 0);
+
+	/* Commands below a filtered command are also hidden */
+	ret = slash_execute(slash, "test sub subsub subsubsub");
+	slash_set_view(slash, NULL);
+	slash_view_destroy(&view);
+	assert_int_equal(ret, SLASH_EUSAGE);
+}
+
 static void slash_test_privileged_command(void **state)
 {
 	struct slash *slash = *state;
@@ -178,6 +477,31 @@ static void slash_test_privileged_command(void **state)
 	slash_set_privileged(slash, false);
 }
 
+static void slash_test_level_command(void **state)
+{
+	struct slash *slash = *state;
+
+	int ret;
+	char *cmd = "developer";
+
+	ret = slash_set_level(slash, SLASH_LEVEL_ENGINEER);
+	assert_int_equal(ret, 0);
+	ret = slash_execute(slash, cmd);
+	assert_int_equal(ret, -ENOENT);
+	ret = slash_execute(slash, "privileged");
+	assert_int_equal(ret, 0);
+
+	ret = slash_set_level(slash, SLASH_LEVEL_DEVELOPER);
+	assert_int_equal(ret, 0);
+	ret = slash_execute(slash, cmd);
+	assert_int_equal(ret, 0);
+
+	ret = slash_set_level(slash, SLASH_LEVEL_COUNT);
+	assert_int_equal(ret, -EINVAL);
+
+	slash_set_privileged(slash, false);
+}
+
 static void slash_test_context_command(void **state)
 {
 	struct slash *slash = *state;
@@ -193,11 +517,639 @@ static void slash_test_partial(void **state)
 {
 	struct slash *slash = *state;
 
+	struct memory_io mem = {0};
+	int ret;
+
+	slash_set_io(slash, &memory_io, &mem);
+
+	/* Ambiguous between subgroup and subset */
+	slash_set_abbreviate(slash, true);
+	ret = slash_execute(slash, "group sub");
+	assert_int_equal(ret, -ENOENT);
+	assert_memory_equal(mem.output, "Ambiguous command: sub\n", 23);
+
+	/* Abbreviations are not accepted unless enabled */
+	slash_set_abbreviate(slash, false);
+	ret = slash_execute(slash, "te su subs");
+	assert_int_equal(ret, -ENOENT);
+
+	slash_set_io(slash, &slash_io_stdio, NULL);
+}
+
+static void slash_test_abbreviation(void **state)
+{
+	struct slash *slash = *state;
+
+	int ret;
+	char *cmd = "te su subs";
+
+	slash_set_abbreviate(slash, true);
+	ret = slash_execute(slash, cmd);
+	slash_set_abbreviate(slash, false);
+	assert_int_equal(ret, 0);
+}
+
+static void slash_test_alias(void **state)
+{
+	struct slash *slash = *state;
+
 	int ret;
-	char *cmd = "e"; /* Partial match on builtin echo */
+	char *cmd = "test s subsub";
 
 	ret = slash_execute(slash, cmd);
+	assert_int_equal(ret, 0);
+
+	/* Aliases do not reach commands in groups above the access level */
+	ret = slash_execute(slash, "rb");
 	assert_int_equal(ret, -ENOENT);
+	ret = slash_execute(slash, "help rb");
+	assert_int_equal(ret, SLASH_EINVAL);
+
+	slash_set_privileged(slash, true);
+	ret = slash_execute(slash, "rb");
+	slash_set_privileged(slash, false);
+	assert_int_equal(ret, 0);
+}
+
+static void slash_test_apropos(void **state)
+{
+	struct slash *slash = *state;
+
+	int ret;
+
+	ret = slash_execute(slash, "apropos LINE text");
+	assert_int_equal(ret, 0);
+
+	ret = slash_execute(slash, "apropos line nothing");
+	assert_int_equal(ret, SLASH_ENOENT);
+}
+
+static void slash_test_const_line(void **state)
+{
+	struct slash *slash = *state;
+
+	int ret;
+	static const char cmd[] = "test 'arg'";
+
+	ret = slash_execute(slash, cmd);
+	assert_int_equal(ret, 0);
+	assert_string_equal(cmd, "test 'arg'");
+
+	/* Line is not NUL-terminated after the command */
+	ret = slash_execute_len(slash, "test argument", 8);
+	assert_int_equal(ret, 0);
+
+	ret = slash_execute(slash, "help test sub");
+	assert_int_equal(ret, 0);
+
+	ret = slash_execute(slash, "help \"test\" sub");
+	assert_int_equal(ret, 0);
+
+	ret = slash_execute(slash, "help test nonexistent");
+	assert_int_equal(ret, SLASH_EINVAL);
+}
+
+static void slash_test_schema(void **state)
+{
+	struct slash *slash = *state;
+
+	int ret;
+
+	ret = slash_execute(slash, "schema 0x3 off abc");
+	assert_int_equal(ret, 0);
+
+	ret = slash_execute(slash, "schema 3 off");
+	assert_int_equal(ret, 0);
+
+	ret = slash_execute(slash, "schema 11 off");
+	assert_int_equal(ret, -ERANGE);
+
+	ret = slash_execute(slash, "schema 3x off");
+	assert_int_equal(ret, -EINVAL);
+
+	ret = slash_execute(slash, "schema 3 maybe");
+	assert_int_equal(ret, -EINVAL);
+
+	ret = slash_execute(slash, "schema 3");
+	assert_int_equal(ret, -EINVAL);
+
+	ret = slash_execute(slash, "schema 3 on a b");
+	assert_int_equal(ret, -E2BIG);
+
+	ret = slash_execute(slash, "help schema");
+	assert_int_equal(ret, 0);
+}
+
+static void slash_test_options(void **state)
+{
+	struct slash *slash = *state;
+
+	int ret;
+
+	ret = slash_execute(slash, "options -vx --verbose --count 3 --color=2 arg");
+	assert_int_equal(ret, 0);
+
+	ret = slash_execute(slash, "options --verb -xvc3 --col=2 -- arg");
+	assert_int_equal(ret, 0);
+
+	ret = slash_execute(slash, "options --co 3 arg");
+	assert_int_equal(ret, SLASH_EUSAGE);
+
+	ret = slash_execute(slash, "options --unknown arg");
+	assert_int_equal(ret, SLASH_EUSAGE);
+
+	ret = slash_execute(slash, "options --verbose=1 arg");
+	assert_int_equal(ret, SLASH_EUSAGE);
+
+	ret = slash_execute(slash, "options -v --count");
+	assert_int_equal(ret, SLASH_EUSAGE);
+}
+
+static void slash_test_prepared(void **state)
+{
+	struct slash *slash = *state;
+
+	struct slash_prepared prepared;
+	int ret, i;
+
+	ret = slash_prepare(slash, &prepared, "test arg");
+	assert_int_equal(ret, 0);
+	for (i = 0; i < 3; i++) {
+		ret = slash_run(slash, &prepared);
+		assert_int_equal(ret, 0);
+	}
+
+	ret = slash_prepare(slash, &prepared, "schema 3 off abc");
+	assert_int_equal(ret, 0);
+	ret = slash_execute(slash, "test arg");
+	assert_int_equal(ret, 0);
+	ret = slash_run(slash, &prepared);
+	assert_int_equal(ret, 0);
+
+	ret = slash_prepare(slash, &prepared, "nonexistent");
+	assert_int_equal(ret, -ENOENT);
+
+	/* Prepared commands follow the access level of the context */
+	slash_set_privileged(slash, true);
+	ret = slash_prepare(slash, &prepared, "privileged");
+	assert_int_equal(ret, 0);
+	slash_set_privileged(slash, false);
+	ret = slash_run(slash, &prepared);
+	assert_int_equal(ret, -ENOENT);
+
+	/* And so do commands in privileged groups */
+	slash_set_privileged(slash, true);
+	ret = slash_prepare(slash, &prepared, "secret reboot");
+	assert_int_equal(ret, 0);
+	ret = slash_run(slash, &prepared);
+	assert_int_equal(ret, 0);
+	slash_set_privileged(slash, false);
+	ret = slash_run(slash, &prepared);
+	assert_int_equal(ret, -ENOENT);
+}
+
+static void slash_test_execute_argv(void **state)
+{
+	struct slash *slash = *state;
+
+	int ret;
+	char *test[] = {"test", "arg"};
+	char *subsub[] = {"test", "sub", "subsub"};
+	char *schema[] = {"schema", "3", "off"};
+	char *unknown[] = {"nonexistent", "arg"};
+	char *help[] = {"help", "test", "sub"};
+
+	ret = slash_execute_argv(slash, 2, test);
+	assert_int_equal(ret, 0);
+
+	ret = slash_execute_argv(slash, 3, subsub);
+	assert_int_equal(ret, 0);
+
+	ret = slash_execute_argv(slash, 3, schema);
+	assert_int_equal(ret, 0);
+
+	ret = slash_execute_argv(slash, 2, unknown);
+	assert_int_equal(ret, -ENOENT);
+
+	ret = slash_execute_argv(slash, 3, help);
+	assert_int_equal(ret, 0);
+}
+
+static void slash_test_chain(void **state)
+{
+	struct slash *slash = *state;
+
+	struct slash_prepared prepared;
+	int ret;
+
+	ret = slash_execute(slash, "test arg; test arg");
+	assert_int_equal(ret, 0);
+
+	ret = slash_execute(slash, "test wrong && test arg");
+	assert_int_equal(ret, SLASH_EINVAL);
+
+	ret = slash_execute(slash, "test wrong || test arg");
+	assert_int_equal(ret, 0);
+
+	ret = slash_execute(slash, "test arg&&nonexistent || test arg");
+	assert_int_equal(ret, 0);
+
+	ret = slash_execute(slash, "test arg || nonexistent && test wrong");
+	assert_int_equal(ret, SLASH_EINVAL);
+
+	ret = slash_execute(slash, "test arg;nonexistent");
+	assert_int_equal(ret, -ENOENT);
+
+	ret = slash_execute(slash, "test wrong; ;test arg; # comment");
+	assert_int_equal(ret, 0);
+
+	/* Quoted and single operator characters are part of the argument */
+	ret = slash_execute(slash, "test 'arg;' || test a&b");
+	assert_int_equal(ret, SLASH_EINVAL);
+
+	/* Exit ends the list */
+	ret = slash_execute(slash, "leave; nonexistent");
+	assert_int_equal(ret, SLASH_EXIT);
+
+	ret = slash_execute(slash, "leave || nonexistent");
+	assert_int_equal(ret, SLASH_EXIT);
+
+	ret = slash_prepare(slash, &prepared, "test arg; test arg");
+	assert_int_equal(ret, -EINVAL);
+}
+
+static void slash_test_variables(void **state)
+{
+	struct slash *slash = *state;
+
+	int ret;
+
+	ret = slash_execute(slash, "set a arg; set b ar; set c 1");
+	assert_int_equal(ret, 0);
+
+	ret = slash_execute(slash, "test $a && test ${b}g && variable $a");
+	assert_int_equal(ret, 0);
+
+	ret = slash_execute(slash, "test '$a'");
+	assert_int_equal(ret, SLASH_EINVAL);
+
+	ret = slash_execute(slash, "test \"$a\"");
+	assert_int_equal(ret, 0);
+
+	ret = slash_execute(slash, "set g test; help $g sub; unset g");
+	assert_int_equal(ret, 0);
+
+	ret = slash_execute(slash, "test $undefined");
+	assert_int_equal(ret, -ENOENT);
+
+	/* Replacing and removing variables compacts the memory */
+	ret = slash_execute(slash, "set a other; set a $a; unset b; set a arg");
+	assert_int_equal(ret, 0);
+	assert_string_equal(slash_get_variable(slash, "a"), "arg");
+	assert_string_equal(slash_get_variable(slash, "c"), "1");
+	assert_null(slash_get_variable(slash, "b"));
+
+	ret = slash_execute(slash, "test $a");
+	assert_int_equal(ret, 0);
+
+	ret = slash_execute(slash, "set 'bad name' x");
+	assert_int_equal(ret, SLASH_EINVAL);
+
+	ret = slash_execute(slash, "unset b");
+	assert_int_equal(ret, SLASH_ENOENT);
+
+	ret = slash_execute(slash, "unset a; unset c; set");
+	assert_int_equal(ret, 0);
+	assert_int_equal(slash->vars_used, 0);
+}
+
+static void slash_test_variables_full(void **state)
+{
+	static char line[LINE_SIZE], history[HISTORY_SIZE], args[256], vars[32];
+	struct slash small, *dynamic;
+	int ret;
+
+	ret = slash_init(&small, line, sizeof(line), history, sizeof(history),
+			 args, sizeof(args));
+	assert_int_equal(ret, 0);
+	slash_set_variable_memory(&small, vars, sizeof(vars));
+
+	ret = slash_execute(&small, "set a x; set b yyyyyy");
+	assert_int_equal(ret, 0);
+	assert_int_equal(small.vars_used, 21);
+
+	/* Old values are removed first when the arena is full */
+	ret = slash_execute(&small, "set a $b");
+	assert_int_equal(ret, 0);
+	assert_string_equal(slash_get_variable(&small, "a"), "yyyyyy");
+	assert_int_equal(small.vars_used, 26);
+
+	/* Values that are not longer are stored in place */
+	ret = slash_execute(&small, "set b zzzzzz; set a 123");
+	assert_int_equal(ret, 0);
+	assert_string_equal(slash_get_variable(&small, "a"), "123");
+	assert_string_equal(slash_get_variable(&small, "b"), "zzzzzz");
+	assert_int_equal(small.vars_used, 23);
+
+	ret = slash_set_variable(&small, "c", "0123456789");
+	assert_int_equal(ret, -ENOSPC);
+
+	/* Memory given to a dynamic context is not freed with it */
+	dynamic = slash_create(LINE_SIZE, HISTORY_SIZE);
+	assert_non_null(dynamic);
+	slash_set_variable_memory(dynamic, vars, sizeof(vars));
+	ret = slash_set_variable(dynamic, "a", "x");
+	assert_int_equal(ret, 0);
+	slash_destroy(dynamic);
+}
+
+static void slash_test_argument_memory(void **state)
+{
+	struct slash *slash = *state;
+
+	static char line[LINE_SIZE], history[HISTORY_SIZE], args[256];
+	struct slash_prepared prepared;
+	struct slash small;
+	char cmd[512];
+	int ret, i, len;
+
+	len = sprintf(cmd, "bulk");
+	for (i = 1; i <= 64; i++)
+		len += sprintf(&cmd[len], " 0x%02x", i);
+
+	ret = slash_prepare(slash, &prepared, "schema 3 off abc");
+	assert_int_equal(ret, 0);
+
+	/* Argument memory of dynamic contexts grows */
+	ret = slash_execute(slash, cmd);
+	assert_int_equal(ret, 0);
+
+	/* String arguments of prepared commands follow the argument memory */
+	ret = slash_run(slash, &prepared);
+	assert_int_equal(ret, 0);
+
+	ret = slash_init(&small, line, sizeof(line), history, sizeof(history),
+			 args, sizeof(args));
+	assert_int_equal(ret, 0);
+
+	ret = slash_execute(&small, cmd);
+	assert_int_equal(ret, -E2BIG);
+
+	ret = slash_execute(&small, "test arg");
+	assert_int_equal(ret, 0);
+
+	/* Prepared commands may run in another context */
+	ret = slash_prepare(&small, &prepared, "schema 3 off abc");
+	assert_int_equal(ret, 0);
+	memset(args, 0, sizeof(args));
+	ret = slash_run(slash, &prepared);
+	assert_int_equal(ret, 0);
+}
+
+static void slash_test_io(void **state)
+{
+	struct slash *slash = *state;
+
+	struct memory_io mem = {0};
+	char *line;
+	int ret;
+
+	slash_set_io(slash, &memory_io, &mem);
+
+	ret = slash_execute(slash, "echo hello world");
+	assert_int_equal(ret, 0);
+	assert_string_equal(mem.output, "hello world\n");
+
+	mem.output_len = 0;
+	ret = slash_execute(slash, "nonexistent");
+	assert_int_equal(ret, -ENOENT);
+	assert_string_equal(mem.output, "No such command: nonexistent\n");
+
+	/* Input is read in blocks */
+	mem.input = "test arg\n";
+	mem.input_len = strlen(mem.input);
+	line = slash_readline(slash);
+	assert_non_null(line);
+	assert_string_equal(line, "test arg");
+	assert_int_equal(mem.reads, 1);
+
+	slash_set_io(slash, &slash_io_stdio, NULL);
+}
+
+static void slash_test_readline_batch(void **state)
+{
+	struct slash *slash = *state;
+
+	struct memory_io mem = {0};
+	char *line;
+
+	slash_set_io(slash, &memory_io, &mem);
+	slash_set_prompt(slash, "> ");
+
+	/* A pasted line is rendered once, with one write per refresh */
+	memset(&slash->stats, 0, sizeof(slash->stats));
+	mem.input = "echo hello\n";
+	mem.input_len = strlen(mem.input);
+	line = slash_readline(slash);
+	assert_non_null(line);
+	assert_string_equal(line, "echo hello");
+	assert_string_equal(mem.output, "\r\033[K> echo hello\n");
+	assert_int_equal(slash->stats.refreshes, 2);
+	assert_int_equal(slash->stats.writes, 3);
+	assert_int_equal(mem.writes, 3);
+	assert_int_equal(slash->stats.bytes, mem.output_len);
+
+	/* Held arrow keys only move the cursor once */
+	mem.output_len = 0;
+	mem.input = "abcd\033[D\033[D\033[DX\n";
+	mem.input_len = strlen(mem.input);
+	line = slash_readline(slash);
+	assert_non_null(line);
+	assert_string_equal(line, "aXbcd");
+	assert_string_equal(mem.output, "\r\033[K> aXbcd\b\b\b\n");
+
+	/* Edits at the start of the line insert and delete characters */
+	mem.output_len = 0;
+	mem.chunk = 1;
+	mem.input = "abcdefghij\001X\177\n";
+	mem.input_len = strlen(mem.input);
+	line = slash_readline(slash);
+	assert_non_null(line);
+	assert_string_equal(line, "abcdefghij");
+	assert_string_equal(mem.output,
+			    "\r\033[K> abcdefghij\033[10D\033[@X\b\033[P\n");
+
+	slash_set_io(slash, &slash_io_stdio, NULL);
+}
+
+static void slash_test_paste(void **state)
+{
+	struct slash *slash = *state;
+
+	static char queue[8];
+	struct memory_io mem = {0};
+	char *line;
+
+	slash_set_io(slash, &memory_io, &mem);
+
+	/* Lines after the first are queued until the paste ends */
+	mem.input = "\033[200~echo one\r\necho\ttwo\nech\033[201~o\n";
+	mem.input_len = strlen(mem.input);
+	line = slash_readline(slash);
+	assert_non_null(line);
+	assert_string_equal(line, "echo one");
+	assert_int_equal(slash->input_len - slash->input_pos, 2);
+	line = slash_readline(slash);
+	assert_non_null(line);
+	assert_string_equal(line, "echo two");
+	assert_int_equal(slash->input_len - slash->input_pos, 2);
+	line = slash_readline(slash);
+	assert_non_null(line);
+	assert_string_equal(line, "echo");
+
+	/* Pasted text is inserted at the cursor */
+	mem.input = "ad\033[D\033[200~bc\033[201~\n";
+	mem.input_len = strlen(mem.input);
+	line = slash_readline(slash);
+	assert_non_null(line);
+	assert_string_equal(line, "abcd");
+
+	/* Lines that do not fit in the queue are dropped */
+	slash_set_paste_memory(slash, queue, sizeof(queue));
+	mem.input = "\033[200~a\nbbbb\ncccccc\n\033[201~d\n";
+	mem.input_len = strlen(mem.input);
+	line = slash_readline(slash);
+	assert_non_null(line);
+	assert_string_equal(line, "a");
+	line = slash_readline(slash);
+	assert_non_null(line);
+	assert_string_equal(line, "bbbb");
+	line = slash_readline(slash);
+	assert_non_null(line);
+	assert_string_equal(line, "d");
+
+	/* The queue is not freed with the context */
+	slash_set_io(slash, &slash_io_stdio, NULL);
+}
+
+static char ring_output[64];
+static size_t ring_output_len;
+
+static void ring_drain(struct slash_ring *ring)
+{
+	const char *data;
+	size_t count;
+
+	while ((count = slash_ring_peek(ring, &data)) > 0) {
+		memcpy(&ring_output[ring_output_len], data, count);
+		ring_output_len += count;
+		slash_ring_consume(ring, count);
+	}
+	ring_output[ring_output_len] = '\0';
+}
+
+static void slash_test_ring(void **state)
+{
+	struct slash *slash = *state;
+
+	struct slash_ring ring;
+	char buffer[16];
+	const char *data;
+	int ret;
+
+	ret = slash_ring_init(&ring, buffer, 12, SLASH_RING_BLOCK, NULL);
+	assert_int_equal(ret, -EINVAL);
+
+	/* Output is queued until the driver consumes it */
+	ret = slash_ring_init(&ring, buffer, sizeof(buffer), SLASH_RING_DROP, NULL);
+	assert_int_equal(ret, 0);
+	slash_set_io(slash, &slash_io_ring, &ring);
+
+	ret = slash_execute(slash, "echo hello");
+	assert_int_equal(ret, 0);
+	assert_int_equal(slash_ring_peek(&ring, &data), 6);
+	assert_memory_equal(data, "hello\n", 6);
+	slash_ring_consume(&ring, 6);
+
+	/* Output that does not fit is dropped */
+	ret = slash_execute(slash, "echo 0123456789 abcdefghij");
+	assert_int_equal(ret, 0);
+	assert_int_equal(ring.dropped, 6);
+	assert_int_equal(slash_ring_peek(&ring, &data), 10);
+	assert_memory_equal(data, "0123456789", 10);
+	slash_ring_consume(&ring, 10);
+	assert_int_equal(slash_ring_peek(&ring, &data), 6);
+	assert_memory_equal(data, " abcde", 6);
+	slash_ring_consume(&ring, 6);
+
+	/* The driver is started after each write */
+	ring_output_len = 0;
+	ring.policy = SLASH_RING_BLOCK;
+	ring.start = ring_drain;
+	ret = slash_execute(slash, "echo 0123456789 abcdefghij");
+	assert_int_equal(ret, 0);
+	assert_string_equal(ring_output, "0123456789 abcdefghij\n");
+
+	/* The writer yields while the ring is full */
+	ring_output_len = 0;
+	ring.policy = SLASH_RING_YIELD;
+	ring.start = NULL;
+	ring.yield = ring_drain;
+	ret = slash_execute(slash, "echo 0123456789 abcdefghij");
+	assert_int_equal(ret, 0);
+	ring_drain(&ring);
+	assert_string_equal(ring_output, "0123456789 abcdefghij\n");
+
+	slash_set_io(slash, &slash_io_stdio, NULL);
+}
+
+static void slash_test_format(void **state)
+{
+	struct slash *slash = *state;
+
+	struct memory_io mem = {0};
+	char buf[16];
+	int ret;
+
+	ret = slash_snprintf(buf, sizeof(buf), "%d %-4s|%04x", -12, "ab", 0xbeef);
+	assert_int_equal(ret, 13);
+	assert_string_equal(buf, "-12 ab  |beef");
+
+	ret = slash_snprintf(buf, sizeof(buf), "%zu %.2s %c%%", (size_t)7, "xyz", 'q');
+	assert_string_equal(buf, "7 xy q%");
+
+	ret = slash_snprintf(buf, sizeof(buf), "%g %g %g", 0.5, 1e-5, 250.0);
+	assert_string_equal(buf, "0.5 1e-05 250");
+
+	ret = slash_snprintf(buf, sizeof(buf), "%.2f %.1f", 123.456, -0.25);
+	assert_string_equal(buf, "123.46 -0.2");
+
+	ret = slash_snprintf(buf, sizeof(buf), "%.2f|%6.1f|", 9.999, 99.96);
+	assert_string_equal(buf, "10.00| 100.0|");
+
+	ret = slash_snprintf(buf, sizeof(buf), "%.2e %.0E", 123.456, 0.0);
+	assert_string_equal(buf, "1.23e+02 0E+00");
+
+	ret = slash_snprintf(buf, sizeof(buf), "%.1e %f", 9.96, 1.0 / 0.0);
+	assert_string_equal(buf, "1.0e+01 inf");
+
+	ret = slash_snprintf(buf, sizeof(buf), "%.3Lf", (long double)2.5);
+	assert_string_equal(buf, "2.500");
+
+	/* Output is truncated to the buffer */
+	ret = slash_snprintf(buf, sizeof(buf), "%s", "0123456789abcdefghij");
+	assert_int_equal(ret, 20);
+	assert_string_equal(buf, "0123456789abcde");
+
+	/* Output longer than the printf buffer is written in pieces */
+	slash_set_io(slash, &memory_io, &mem);
+	ret = slash_printf(slash, "%*d|", SLASH_PRINTF_SIZE + 20, 1);
+	assert_int_equal(ret, SLASH_PRINTF_SIZE + 21);
+	assert_int_equal(mem.output_len, SLASH_PRINTF_SIZE + 21);
+	assert_int_equal(mem.writes, 2);
+	assert_string_equal(&mem.output[SLASH_PRINTF_SIZE + 18], " 1|");
+
+	slash_set_io(slash, &slash_io_stdio, NULL);
 }
 
 static int setup(void **state)
@@ -225,9 +1177,32 @@ int main(void)
 		cmocka_unit_test(slash_test_subsub_command),
 		cmocka_unit_test(slash_test_subsubsub_command),
 		cmocka_unit_test(slash_test_subsubsub_command_in_group),
+		cmocka_unit_test(slash_test_group_command),
+		cmocka_unit_test(slash_test_unknown_subcommand),
+		cmocka_unit_test(slash_test_register_command),
+		cmocka_unit_test(slash_test_register_subcommand),
+		cmocka_unit_test(slash_test_view),
 		cmocka_unit_test(slash_test_privileged_command),
+		cmocka_unit_test(slash_test_level_command),
 		cmocka_unit_test(slash_test_context_command),
 		cmocka_unit_test(slash_test_partial),
+		cmocka_unit_test(slash_test_abbreviation),
+		cmocka_unit_test(slash_test_alias),
+		cmocka_unit_test(slash_test_apropos),
+		cmocka_unit_test(slash_test_const_line),
+		cmocka_unit_test(slash_test_schema),
+		cmocka_unit_test(slash_test_options),
+		cmocka_unit_test(slash_test_prepared),
+		cmocka_unit_test(slash_test_execute_argv),
+		cmocka_unit_test(slash_test_chain),
+		cmocka_unit_test(slash_test_variables),
+		cmocka_unit_test(slash_test_variables_full),
+		cmocka_unit_test(slash_test_argument_memory),
+		cmocka_unit_test(slash_test_io),
+		cmocka_unit_test(slash_test_readline_batch),
+		cmocka_unit_test(slash_test_paste),
+		cmocka_unit_test(slash_test_ring),
+		cmocka_unit_test(slash_test_format),
 	};
 
 	return cmocka_run_group_tests(tests, setup, teardown);
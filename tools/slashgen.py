@@ -0,0 +1,391 @@
+#!/usr/bin/env python3
+# encoding: utf-8
+
+"""
+Generate a read-only slash command index at build time.
+
+The slash_command() macros place each command in an ELF section named after
+the command path, e.g. '.slash.group.sub.name'. This tool reads the sections
+and symbol tables of the relocatable objects and archives that make up the
+final link and writes a C source file defining slash_command_table[] and
+slash_command_table_count. When the generated file is linked in, slash uses
+the table directly from read-only memory instead of building the index in RAM.
+
+The table must be generated from exactly the set of objects that is linked,
+including the object containing slash.c. If the command count does not match
+at runtime, slash falls back to building the index in RAM.
+
+When the objects are compiled with SLASH_COMPRESS_HELP, the help text of each
+command is stored as a C string literal in a '.slash_help.<path>' section that
+the linker script discards. This tool then also writes the help text
+compressed with a shared dictionary of up to 128 words: bytes 0x80-0xff refer
+to a dictionary word, 0x01 escapes the following byte, and all other bytes are
+literal characters.
+"""
+
+import argparse
+import collections
+import re
+import struct
+import sys
+
+SECTION_PREFIX = '.slash.'
+HELP_PREFIX = '.slash_help.'
+
+HELP_ESCAPE = 0x01
+HELP_WORD = 0x80
+HELP_WORDS = 0x100 - HELP_WORD
+
+SHT_SYMTAB = 2
+SHT_SYMTAB_SHNDX = 18
+STT_OBJECT = 1
+STB_LOCAL = 0
+SHN_XINDEX = 0xffff
+
+
+class Section(object):
+    def __init__(self, name, kind, offset, size, link, data):
+        self.name = name
+        self.type = kind
+        self.offset = offset
+        self.size = size
+        self.link = link
+        self.data = data
+
+
+class Elf(object):
+    """Minimal reader for ELF relocatable objects"""
+
+    def __init__(self, data, path):
+        if data[:4] != b'\x7fELF':
+            raise ValueError('{}: not an ELF file'.format(path))
+
+        self.path = path
+        self.data = data
+        self.is64 = data[4] == 2
+        self.endian = '<' if data[5] == 1 else '>'
+
+        if self.is64:
+            hdr = struct.unpack_from(self.endian + 'HHIQQQIHHHHHH', data, 16)
+        else:
+            hdr = struct.unpack_from(self.endian + 'HHIIIIIHHHHHH', data, 16)
+        shoff, shentsize, shnum, shstrndx = hdr[5], hdr[10], hdr[11], hdr[12]
+
+        self.sections = []
+        if shoff == 0:
+            return
+
+        # Large section counts are stored in the first section header
+        first = self._section_header(shoff)
+        if shnum == 0:
+            shnum = first[3]
+        if shstrndx == SHN_XINDEX:
+            shstrndx = first[4]
+
+        headers = [self._section_header(shoff + i * shentsize)
+                   for i in range(shnum)]
+        strtab = headers[shstrndx]
+        for name, kind, offset, size, link in headers:
+            self.sections.append(Section(
+                self._string(strtab[2], name), kind, offset, size, link,
+                data[offset:offset + size] if kind != 8 else b''))
+
+    def _section_header(self, offset):
+        if self.is64:
+            h = struct.unpack_from(self.endian + 'IIQQQQIIQQ', self.data, offset)
+        else:
+            h = struct.unpack_from(self.endian + 'IIIIIIIIII', self.data, offset)
+        return h[0], h[1], h[4], h[5], h[6]
+
+    def _string(self, offset, index):
+        end = self.data.index(b'\0', offset + index)
+        return self.data[offset + index:end].decode('ascii', 'replace')
+
+    def symbols(self):
+        """Yield (name, section index, binding, type) for all symbols"""
+        for symtab in self.sections:
+            if symtab.type != SHT_SYMTAB:
+                continue
+
+            strtab = self.sections[symtab.link]
+            xindex = [s for s in self.sections
+                      if s.type == SHT_SYMTAB_SHNDX and
+                      self.sections[s.link] is symtab]
+
+            entsize = 24 if self.is64 else 16
+            for i in range(symtab.size // entsize):
+                if self.is64:
+                    name, info, _, shndx, _, _ = struct.unpack_from(
+                        self.endian + 'IBBHQQ', symtab.data, i * entsize)
+                else:
+                    name, _, _, info, _, shndx = struct.unpack_from(
+                        self.endian + 'IIIBBH', symtab.data, i * entsize)
+                if shndx == SHN_XINDEX and xindex:
+                    shndx, = struct.unpack_from(self.endian + 'I',
+                                                xindex[0].data, i * 4)
+                yield (self._string(strtab.offset, name), shndx,
+                       info >> 4, info & 0xf)
+
+
+def archive_members(data, path):
+    """Yield member contents of an ar(1) archive"""
+    offset = 8
+    while offset + 60 <= len(data):
+        header = data[offset:offset + 60]
+        name = header[:16].decode('ascii', 'replace').strip()
+        size = int(header[48:58].decode('ascii').strip())
+        offset += 60
+        if name not in ('/', '//', '/SYM64/', '__.SYMDEF', '__.SYMDEF SORTED'):
+            yield data[offset:offset + size]
+        offset += size + (size & 1)
+
+
+def read_objects(path):
+    with open(path, 'rb') as f:
+        data = f.read()
+
+    if data.startswith(b'!<thin>\n'):
+        raise ValueError('{}: thin archives are not supported'.format(path))
+    if data.startswith(b'!<arch>\n'):
+        return [Elf(m, path) for m in archive_members(data, path)]
+    return [Elf(data, path)]
+
+
+def parse_literal(text):
+    """Return bytes of a sequence of C string literals, or None for NULL"""
+    escapes = {'a': 7, 'b': 8, 'f': 12, 'n': 10, 'r': 13, 't': 9, 'v': 11}
+
+    text = text.strip()
+    if not text.startswith('"'):
+        return None
+
+    out = bytearray()
+    for literal in re.findall(r'"((?:[^"\\]|\\.)*)"', text):
+        i = 0
+        while i < len(literal):
+            c = literal[i]
+            i += 1
+            if c != '\\':
+                out.append(ord(c))
+                continue
+            c = literal[i]
+            i += 1
+            if c in escapes:
+                out.append(escapes[c])
+            elif c == 'x':
+                digits = re.match(r'[0-9a-fA-F]+', literal[i:]).group()
+                out.append(int(digits, 16) & 0xff)
+                i += len(digits)
+            elif c in '01234567':
+                digits = re.match(r'[0-7]{1,3}', literal[i - 1:]).group()
+                out.append(int(digits, 8) & 0xff)
+                i += len(digits) - 1
+            else:
+                out.append(ord(c))
+
+    # Help text ends at the first NUL like any C string
+    return bytes(out).split(b'\0')[0]
+
+
+def read_help(elf, helps):
+    """Add help text of commands compiled with SLASH_COMPRESS_HELP"""
+    for section in elf.sections:
+        if not section.name.startswith(HELP_PREFIX):
+            continue
+        cmd = tuple(section.name[len(HELP_PREFIX):].split('.'))
+        text = section.data.split(b'\0')[0].decode('latin-1')
+        helps[cmd] = parse_literal(text)
+
+
+def read_commands(paths):
+    """Return dicts mapping command path tuple to command symbol and help"""
+    commands = {}
+    helps = {}
+
+    for path in paths:
+        for elf in read_objects(path):
+            read_help(elf, helps)
+            for name, shndx, bind, kind in elf.symbols():
+                if kind != STT_OBJECT or bind == STB_LOCAL:
+                    continue
+                if shndx == 0 or shndx >= len(elf.sections):
+                    continue
+
+                section = elf.sections[shndx].name
+                if not section.startswith(SECTION_PREFIX):
+                    continue
+
+                cmd = tuple(section[len(SECTION_PREFIX):].split('.'))
+                if cmd in commands:
+                    raise ValueError('{}: duplicate command \'{}\''.format(
+                        elf.path, ' '.join(cmd)))
+                commands[cmd] = name
+
+    for cmd in commands:
+        if len(cmd) > 1 and cmd[:-1] not in commands:
+            raise ValueError('command \'{}\' has no parent'.format(
+                ' '.join(cmd)))
+
+    return commands, helps
+
+
+def build_nodes(commands):
+    """Return list of (path, child, children) in breadth-first order"""
+    children = {(): []}
+    for cmd in commands:
+        children.setdefault(cmd, [])
+        children.setdefault(cmd[:-1], []).append(cmd)
+
+    nodes = [()]
+    index = []
+    for cmd in nodes:
+        siblings = sorted(children[cmd], key=lambda c: c[-1].encode('ascii'))
+        index.append((cmd, len(nodes), len(siblings)))
+        nodes.extend(siblings)
+
+    if len(index) > 0xffff:
+        raise ValueError('too many commands ({})'.format(len(index)))
+    for cmd in commands:
+        if len(cmd[-1]) > 0xff:
+            raise ValueError('command name \'{}\' too long'.format(cmd[-1]))
+
+    return index
+
+
+def name_prefix(name):
+    """First four bytes of name packed big-endian, see struct slash_node"""
+    return struct.unpack('>I', name[:4].ljust(4, b'\0'))[0]
+
+
+def build_dictionary(texts):
+    """Return the words that save the most bytes when replaced by one byte"""
+    counts = collections.Counter()
+    for text in texts:
+        counts.update(re.findall(rb'[^ \n]{2,} ?', text))
+
+    # Each word also costs its NUL terminator and offset in the dictionary
+    def saving(word):
+        return counts[word] * (len(word) - 1) - len(word) - 3
+
+    words = sorted(counts, key=lambda w: (-saving(w), w))
+    return [w for w in words[:HELP_WORDS] if saving(w) > 0]
+
+
+def compress(text, words):
+    """Compress text by replacing the longest dictionary word at each byte"""
+    candidates = collections.defaultdict(list)
+    for index, word in sorted(enumerate(words), key=lambda w: -len(w[1])):
+        candidates[word[0]].append((index, word))
+
+    out = bytearray()
+    i = 0
+    while i < len(text):
+        for index, word in candidates[text[i]]:
+            if text.startswith(word, i):
+                out.append(HELP_WORD + index)
+                i += len(word)
+                break
+        else:
+            if text[i] == HELP_ESCAPE or text[i] >= HELP_WORD:
+                out.append(HELP_ESCAPE)
+            out.append(text[i])
+            i += 1
+
+    return bytes(out)
+
+
+def c_string(data):
+    """Format bytes as C string literal"""
+    out = []
+    for c in bytearray(data):
+        if c == 0x0a:
+            out.append('\\n')
+        elif 0x20 <= c < 0x7f and chr(c) not in '"\\?':
+            out.append(chr(c))
+        else:
+            out.append('\\{:03o}'.format(c))
+    return '"' + ''.join(out) + '"'
+
+
+def write_help(out, commands, helps, report):
+    texts = {cmd: text for cmd, text in sorted(helps.items())
+             if text is not None and cmd in commands}
+    words = build_dictionary(texts.values())
+
+    out.write('\n/* Help text dictionary, see SLASH_COMPRESS_HELP */\n')
+    out.write('const char slash_help_dict[] =\n')
+    for word in words:
+        out.write('\t{}\n'.format(c_string(word + b'\0')))
+    out.write('\t"";\n\n')
+
+    offsets, offset = [], 0
+    for word in words:
+        offsets.append(offset)
+        offset += len(word) + 1
+    out.write('const uint16_t slash_help_dict_offset[] = {{ {} }};\n\n'.format(
+        ', '.join(str(o) for o in offsets) or '0'))
+
+    size = compressed = 0
+    for cmd, text in texts.items():
+        data = compress(text, words)
+        out.write('const char slash_help_{}[] = {};\n'.format(
+            commands[cmd], c_string(data)))
+        size += len(text) + 1
+        compressed += len(data) + 1
+
+    if report:
+        dictionary = offset + 2 * len(words)
+        saved = size - compressed - dictionary
+        sys.stdout.write(
+            'slashgen: help text of {} commands: {} bytes, compressed {} bytes '
+            '+ {} bytes dictionary, saved {} bytes ({:.0f}%)\n'.format(
+                len(texts), size, compressed, dictionary, saved,
+                100.0 * saved / size if size else 0))
+
+
+def write_table(out, commands, nodes):
+    out.write('/* Generated by slashgen.py from {} commands. Do not edit. */\n\n'
+              .format(len(commands)))
+    out.write('#include <slash/slash.h>\n\n')
+
+    for cmd, _, _ in nodes[1:]:
+        out.write('extern struct slash_command {};\n'.format(commands[cmd]))
+
+    out.write('\nconst struct slash_node slash_command_table[] = {\n')
+    for cmd, child, count in nodes:
+        ref = '&' + commands[cmd] if cmd else 'NULL'
+        name = cmd[-1].encode('ascii') if cmd else b''
+        out.write('\t{{ {}, {:#010x}, {}, {}, {} }},\t/* {} */\n'.format(
+            ref, name_prefix(name), child, count, len(name),
+            ' '.join(cmd) if cmd else '<root>'))
+    out.write('};\n\n')
+    out.write('const size_t slash_command_table_count = {};\n'.format(len(nodes)))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().split('\n')[0])
+    parser.add_argument('-o', '--output', required=True,
+                        help='generated C source file')
+    parser.add_argument('-r', '--report', action='store_true',
+                        help='print size of compressed help text')
+    parser.add_argument('inputs', nargs='+',
+                        help='object files and archives to read commands from')
+    args = parser.parse_args()
+
+    try:
+        commands, helps = read_commands(args.inputs)
+        nodes = build_nodes(commands)
+    except (ValueError, IOError) as e:
+        sys.stderr.write('slashgen: {}\n'.format(e))
+        return 1
+
+    with open(args.output, 'w') as out:
+        write_table(out, commands, nodes)
+        if helps:
+            write_help(out, commands, helps, args.report)
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())